@@ -0,0 +1,42 @@
+#ifndef LABEL_BOUNDS_CPP
+#define LABEL_BOUNDS_CPP
+#include <vector>
+#include <algorithm>
+
+using namespace cv;
+
+/*
+  the bounding box of every label in one pass over a CV_32S label image, where inRange +
+  boundingRect cost a full frame pass per label. bounds[i - 1] is label i, and so is areas[i - 1],
+  its pixel count, if areas is given.
+ */
+void label_bounds(const Mat &labels, int components, std::vector<Rect> &bounds, std::vector<int> *areas = nullptr)
+{
+    bounds.assign(std::max(components - 1, 0), Rect(labels.cols, labels.rows, 0, 0));
+    if(areas)
+	areas->assign(bounds.size(), 0);
+
+    //bounds are kept as corners (x, y, x2, y2) while scanning and turned into width/height after
+    for(int y = 0; y < labels.rows; y++)
+    {
+	const int *row = labels.ptr<int>(y);
+	for(int x = 0; x < labels.cols; x++)
+	{
+	    if(row[x] == 0)
+		continue;
+	    Rect &b = bounds[row[x] - 1];
+	    b.x = std::min(b.x, x);
+	    b.y = std::min(b.y, y);
+	    b.width = std::max(b.width, x);
+	    b.height = std::max(b.height, y);
+	    if(areas)
+		(*areas)[row[x] - 1]++;
+	}
+    }
+    for(Rect &b : bounds)
+    {
+	b.width = b.width - b.x + 1;
+	b.height = b.height - b.y + 1;
+    }
+}
+#endif
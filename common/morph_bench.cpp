@@ -0,0 +1,67 @@
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include <stdio.h>
+#include <chrono>
+#include "rect_morphology.cpp"
+
+//./morph_bench
+//./morph_bench /mnt/c/Users/Sasha/Downloads/keyboard.png
+
+#define ITERATIONS 20
+
+double time_ms(void (*run)(const Mat &, Mat &, int, int, rect_morph_buffers *), const Mat &src, Mat &dst,
+	       int op, int k, rect_morph_buffers *buf)
+{
+    run(src, dst, op, k, buf);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < ITERATIONS; i++)
+	run(src, dst, op, k, buf);
+    return(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / ITERATIONS);
+}
+
+void run_opencv(const Mat &src, Mat &dst, int op, int k, rect_morph_buffers *)
+{
+    morphologyEx(src, dst, op, getStructuringElement(MORPH_RECT, Size(k, k)));
+}
+
+void run_rect(const Mat &src, Mat &dst, int op, int k, rect_morph_buffers *buf)
+{
+    rect_morphology(src, dst, op, Size(k, k), buf);
+}
+
+int main(int argc, char** argv)
+{
+    Mat src;
+    if(argc > 1)
+    {
+	Mat gray = imread(argv[1], 0);
+	if(!gray.data)
+	    return(-1);
+	threshold(gray, src, 128, 255, THRESH_BINARY);
+    }
+    else
+    {
+	src.create(1080, 1920, CV_8UC1);
+	randu(src, Scalar::all(0), Scalar::all(255));
+	threshold(src, src, 200, 255, THRESH_BINARY);
+    }
+
+    const char *names[] = { "erode", "dilate", "open", "close" };
+    int ops[] = { MORPH_ERODE, MORPH_DILATE, MORPH_OPEN, MORPH_CLOSE };
+    rect_morph_buffers buf;
+    printf("%dx%d\n", src.cols, src.rows);
+    printf("%-7s %4s %12s %12s %8s %s\n", "op", "k", "opencv ms", "rect ms", "speedup", "match");
+    for(int o = 0; o < 4; o++)
+    {
+	for(int k = 3; k <= 51; k += 8)
+	{
+	    Mat expected, got;
+	    double opencv_ms = time_ms(run_opencv, src, expected, ops[o], k, &buf);
+	    double rect_ms = time_ms(run_rect, src, got, ops[o], k, &buf);
+	    bool match = countNonZero(expected != got) == 0;
+	    printf("%-7s %4d %12.3f %12.3f %7.2fx %s\n", names[o], k, opencv_ms, rect_ms, opencv_ms / rect_ms,
+		   match ? "yes" : "NO");
+	}
+    }
+    return(0);
+}
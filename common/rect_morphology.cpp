@@ -0,0 +1,186 @@
+#ifndef RECT_MORPHOLOGY_CPP
+#define RECT_MORPHOLOGY_CPP
+#include <vector>
+#include <algorithm>
+#include <stddef.h>
+
+using namespace cv;
+
+/*
+  erode/dilate/open/close with a w x h rectangle on 8 bit single channel images.
+  a rectangle is separable, so it's a 1 x w pass along the rows followed by an h x 1 pass down
+  the columns, and each 1d pass uses van Herk/Gil-Werman: cut the line into blocks of k, take
+  running min (or max) forwards and backwards inside each block, and then any window of k is just
+  op(backward[i], forward[i + k - 1]). that's three ops per pixel per pass no matter how big k is,
+  where morphologyEx with a full kernel costs more the bigger the rectangle gets.
+
+  borders behave like opencv's default: pixels outside the image never win, so they're 255 for
+  erode and 0 for dilate. the anchor is the center (k / 2), same as getStructuringElement's.
+  src and dst may be the same Mat.
+ */
+struct rect_morph_buffers
+{
+    std::vector<uchar> row_pad;
+    std::vector<uchar> row_forward;
+    std::vector<uchar> row_backward;
+    std::vector<uchar> border;
+    std::vector<uchar> col_forward;
+    std::vector<uchar> col_backward;
+    std::vector<uchar> rows_done;
+    std::vector<uchar> stage;
+};
+
+struct min_op
+{
+    enum { outside = 255 };
+    uchar operator()(uchar a, uchar b) const { return(a < b ? a : b); }
+};
+
+struct max_op
+{
+    enum { outside = 0 };
+    uchar operator()(uchar a, uchar b) const { return(a > b ? a : b); }
+};
+
+template<typename Op>
+void rect_row_pass(const uchar *src, size_t src_step, uchar *dst, size_t dst_step,
+		   int rows, int cols, int k, rect_morph_buffers *buf)
+{
+    Op op;
+    int anchor = k / 2;
+    int padded = cols + k - 1;
+    int blocks = (padded + k - 1) / k * k;
+    buf->row_pad.assign(blocks, (uchar)Op::outside);
+    buf->row_forward.resize(blocks);
+    buf->row_backward.resize(blocks);
+    uchar *pad = buf->row_pad.data();
+    uchar *forward = buf->row_forward.data();
+    uchar *backward = buf->row_backward.data();
+
+    for(int y = 0; y < rows; y++)
+    {
+	const uchar *s = src + y * src_step;
+	std::copy(s, s + cols, pad + anchor);
+
+	for(int start = 0; start < blocks; start += k)
+	{
+	    forward[start] = pad[start];
+	    for(int j = start + 1; j < start + k; j++)
+		forward[j] = op(forward[j - 1], pad[j]);
+	    backward[start + k - 1] = pad[start + k - 1];
+	    for(int j = start + k - 2; j >= start; j--)
+		backward[j] = op(backward[j + 1], pad[j]);
+	}
+
+	uchar *d = dst + y * dst_step;
+	for(int x = 0; x < cols; x++)
+	    d[x] = op(backward[x], forward[x + k - 1]);
+    }
+}
+
+/*
+  the column pass runs the same recurrence a whole row at a time, so every inner loop is
+  a straight elementwise min/max over a row that the compiler can vectorize.
+ */
+template<typename Op>
+void rect_col_pass(const uchar *src, size_t src_step, uchar *dst, size_t dst_step,
+		   int rows, int cols, int k, rect_morph_buffers *buf)
+{
+    Op op;
+    int anchor = k / 2;
+    int padded = rows + k - 1;
+    int blocks = (padded + k - 1) / k * k;
+    buf->border.assign(cols, (uchar)Op::outside);
+    buf->col_forward.resize((size_t)blocks * cols);
+    buf->col_backward.resize((size_t)blocks * cols);
+    const uchar *border = buf->border.data();
+    uchar *forward = buf->col_forward.data();
+    uchar *backward = buf->col_backward.data();
+
+    for(int start = 0; start < blocks; start += k)
+    {
+	for(int j = start; j < start + k; j++)
+	{
+	    int y = j - anchor;
+	    const uchar *p = y >= 0 && y < rows ? src + y * src_step : border;
+	    uchar *f = forward + (size_t)j * cols;
+	    if(j == start)
+		std::copy(p, p + cols, f);
+	    else
+	    {
+		const uchar *prev = f - cols;
+		for(int x = 0; x < cols; x++)
+		    f[x] = op(prev[x], p[x]);
+	    }
+	}
+	for(int j = start + k - 1; j >= start; j--)
+	{
+	    int y = j - anchor;
+	    const uchar *p = y >= 0 && y < rows ? src + y * src_step : border;
+	    uchar *b = backward + (size_t)j * cols;
+	    if(j == start + k - 1)
+		std::copy(p, p + cols, b);
+	    else
+	    {
+		const uchar *next = b + cols;
+		for(int x = 0; x < cols; x++)
+		    b[x] = op(next[x], p[x]);
+	    }
+	}
+    }
+
+    for(int y = 0; y < rows; y++)
+    {
+	const uchar *b = backward + (size_t)y * cols;
+	const uchar *f = forward + (size_t)(y + k - 1) * cols;
+	uchar *d = dst + y * dst_step;
+	for(int x = 0; x < cols; x++)
+	    d[x] = op(b[x], f[x]);
+    }
+}
+
+template<typename Op>
+void rect_pass(const uchar *src, size_t src_step, uchar *dst, size_t dst_step,
+	       int rows, int cols, Size ksize, rect_morph_buffers *buf)
+{
+    int kw = std::max(ksize.width, 1);
+    int kh = std::max(ksize.height, 1);
+    buf->rows_done.resize((size_t)rows * cols);
+    uchar *rows_done = buf->rows_done.data();
+    rect_row_pass<Op>(src, src_step, rows_done, cols, rows, cols, kw, buf);
+    rect_col_pass<Op>(rows_done, cols, dst, dst_step, rows, cols, kh, buf);
+}
+
+void rect_morphology(const uchar *src, size_t src_step, uchar *dst, size_t dst_step,
+		     int rows, int cols, int op, Size ksize, rect_morph_buffers *buf)
+{
+    switch(op)
+    {
+    case MORPH_ERODE:
+	rect_pass<min_op>(src, src_step, dst, dst_step, rows, cols, ksize, buf);
+	break;
+    case MORPH_DILATE:
+	rect_pass<max_op>(src, src_step, dst, dst_step, rows, cols, ksize, buf);
+	break;
+    case MORPH_OPEN:
+	buf->stage.resize((size_t)rows * cols);
+	rect_pass<min_op>(src, src_step, buf->stage.data(), cols, rows, cols, ksize, buf);
+	rect_pass<max_op>(buf->stage.data(), cols, dst, dst_step, rows, cols, ksize, buf);
+	break;
+    case MORPH_CLOSE:
+	buf->stage.resize((size_t)rows * cols);
+	rect_pass<max_op>(src, src_step, buf->stage.data(), cols, rows, cols, ksize, buf);
+	rect_pass<min_op>(buf->stage.data(), cols, dst, dst_step, rows, cols, ksize, buf);
+	break;
+    }
+}
+
+//drop in for morphologyEx(src, dst, op, getStructuringElement(MORPH_RECT, ksize))
+void rect_morphology(const Mat &src, Mat &dst, int op, Size ksize, rect_morph_buffers *buf)
+{
+    CV_Assert(src.type() == CV_8UC1);
+    dst.create(src.size(), CV_8UC1);
+    rect_morphology(src.ptr<uchar>(0), src.step, dst.ptr<uchar>(0), dst.step,
+		    src.rows, src.cols, op, ksize, buf);
+}
+#endif
@@ -0,0 +1,237 @@
+#define CV_PRACTICE_NO_MAIN
+#define KEYBOARD_TRACKER_NO_MAIN
+#include "../tennisball/cv_practice.cpp"
+#include "../keyboard/keyboard_tracker.cpp"
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+//./tracker_bench /mnt/c/Users/Sasha/Downloads/frames/ > bench.json
+//./tracker_bench /mnt/c/Users/Sasha/Downloads/tennisball.mp4 10 --ball > bench.json
+
+/*
+  headless benchmark for both trackers, nothing is shown so it can run on the robot or in ci.
+  every frame is decoded up front so only the trackers are timed. each stage is timed on its own
+  and reported as p50/p95/p99 latency, along with frames per second through the whole tracker
+  and the peak resident set size of the process, as json on stdout.
+  the first pass over the frames is a warmup and isn't counted, it's where the workspaces grow.
+ */
+#define BENCH_MAX_VIDEO_FRAMES 300
+
+struct stage_times
+{
+    const char *name;
+    vector<double> ms;
+};
+
+struct tracker_times
+{
+    const char *name;
+    vector<stage_times> stages;
+    double seconds;
+};
+
+void init_times(tracker_times *t, const char *name, const char **stages, int count)
+{
+    t->name = name;
+    t->seconds = 0.0;
+    t->stages.resize(count + 1);
+    for(int i = 0; i < count; i++)
+	t->stages[i].name = stages[i];
+    t->stages[count].name = "total";
+}
+
+//records the time since *last for stage i and moves *last up to now
+void time_stage(tracker_times *t, int i, stream_clock::time_point *last)
+{
+    stream_clock::time_point now = stream_clock::now();
+    t->stages[i].ms.push_back(std::chrono::duration<double, std::milli>(now - *last).count());
+    *last = now;
+}
+
+void time_total(tracker_times *t, stream_clock::time_point start, stream_clock::time_point end)
+{
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+    t->stages.back().ms.push_back(ms);
+    t->seconds += ms / 1000.0;
+}
+
+bool load_frames(const char *source, vector<Mat> &frames)
+{
+    struct stat st;
+    if(stat(source, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+	vector<String> files;
+	glob(String(source) + "/*", files);
+	for(const String &file : files)
+	{
+	    Mat image = imread(file, 1);
+	    if(image.data)
+		frames.push_back(image);
+	}
+	return(!frames.empty());
+    }
+
+    Mat image = imread(source, 1);
+    if(image.data)
+    {
+	frames.push_back(image);
+	return(true);
+    }
+    VideoCapture cap(source);
+    Mat frame;
+    while(frames.size() < BENCH_MAX_VIDEO_FRAMES && cap.read(frame))
+	frames.push_back(frame.clone());
+    return(!frames.empty());
+}
+
+void bench_ball(const vector<Mat> &frames, int iterations, tracker_times *t)
+{
+    const char *stages[] = { "threshold", "morphology", "components" };
+    init_times(t, "ball", stages, 3);
+    ball_workspace ws;
+    for(const Mat &frame : frames)
+	circular_components(overall_filter(frame, &ws), &ws);
+
+    for(int it = 0; it < iterations; it++)
+    {
+	for(const Mat &frame : frames)
+	{
+	    stream_clock::time_point start = stream_clock::now();
+	    stream_clock::time_point last = start;
+	    threshold_image(frame, &ws);
+	    time_stage(t, 0, &last);
+	    morphed_img(ws.thresh, &ws);
+	    time_stage(t, 1, &last);
+	    circular_components(ws.filtered, &ws);
+	    time_stage(t, 2, &last);
+	    time_total(t, start, last);
+	}
+    }
+}
+
+void bench_keyboard(const vector<Mat> &frames, int iterations, tracker_times *t)
+{
+    const char *stages[] = { "gray", "edges", "mask", "keys", "score" };
+    init_times(t, "keyboard", stages, 5);
+    KeyboardTracker keyboard;
+    keyboard_workspace *ws = &keyboard.ws;
+    for(const Mat &frame : frames)
+	keyboard.detect(frame);
+
+    for(int it = 0; it < iterations; it++)
+    {
+	for(const Mat &frame : frames)
+	{
+	    stream_clock::time_point start = stream_clock::now();
+	    stream_clock::time_point last = start;
+	    keyboard_gray(ws, frame, keyboard.params.blur_size);
+	    time_stage(t, 0, &last);
+	    keyboard_edges(ws, ws->gray, keyboard.params.canny_thresh);
+	    time_stage(t, 1, &last);
+	    keyboard_mask(ws);
+	    time_stage(t, 2, &last);
+	    keyboard_keys(ws, frame.size());
+	    time_stage(t, 3, &last);
+	    keyboard_score(ws, ws->gray);
+	    time_stage(t, 4, &last);
+	    time_total(t, start, last);
+	}
+    }
+}
+
+//nearest rank, ms has to be sorted
+double percentile(const vector<double> &ms, double p)
+{
+    int rank = (int)ceil(p / 100.0 * ms.size());
+    return(ms[std::max(rank, 1) - 1]);
+}
+
+void print_json_string(const char *s)
+{
+    putchar('"');
+    for(; *s; s++)
+    {
+	if(*s == '"' || *s == '\\')
+	    putchar('\\');
+	putchar(*s);
+    }
+    putchar('"');
+}
+
+void print_tracker(tracker_times *t, bool last)
+{
+    long frames = t->stages.back().ms.size();
+    printf("    \"%s\": {\n", t->name);
+    printf("      \"frames\": %ld,\n", frames);
+    printf("      \"throughput_fps\": %.3f,\n", t->seconds > 0.0 ? frames / t->seconds : 0.0);
+    printf("      \"stages_ms\": {\n");
+    for(int i = 0; i < (int)t->stages.size(); i++)
+    {
+	vector<double> &ms = t->stages[i].ms;
+	std::sort(ms.begin(), ms.end());
+	printf("        \"%s\": { \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }%s\n",
+	       t->stages[i].name, percentile(ms, 50), percentile(ms, 95), percentile(ms, 99), ms.back(),
+	       i + 1 < (int)t->stages.size() ? "," : "");
+    }
+    printf("      }\n");
+    printf("    }%s\n", last ? "" : ",");
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+	fprintf(stderr, "usage: %s <image directory | image | video file> [iterations] [--ball | --keyboard]\n", argv[0]);
+	return(-1);
+    }
+    int iterations = 10;
+    bool ball = true;
+    bool keyboard = true;
+    for(int i = 2; i < argc; i++)
+    {
+	if(strcmp(argv[i], "--ball") == 0)
+	    keyboard = false;
+	else if(strcmp(argv[i], "--keyboard") == 0)
+	    ball = false;
+	else
+	    iterations = std::max(atoi(argv[i]), 1);
+    }
+
+    vector<Mat> frames;
+    if(!load_frames(argv[1], frames))
+    {
+	fprintf(stderr, "couldn't read any frames from %s\n", argv[1]);
+	return(-1);
+    }
+
+    vector<tracker_times> trackers;
+    if(ball)
+    {
+	trackers.push_back(tracker_times());
+	bench_ball(frames, iterations, &trackers.back());
+    }
+    if(keyboard)
+    {
+	trackers.push_back(tracker_times());
+	bench_keyboard(frames, iterations, &trackers.back());
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\n");
+    printf("  \"source\": ");
+    print_json_string(argv[1]);
+    printf(",\n");
+    printf("  \"images\": %lu,\n", frames.size());
+    printf("  \"width\": %d,\n", frames[0].cols);
+    printf("  \"height\": %d,\n", frames[0].rows);
+    printf("  \"iterations\": %d,\n", iterations);
+    printf("  \"peak_rss_kb\": %ld,\n", usage.ru_maxrss);
+    printf("  \"trackers\": {\n");
+    for(int i = 0; i < (int)trackers.size(); i++)
+	print_tracker(&trackers[i], i + 1 == (int)trackers.size());
+    printf("  }\n");
+    printf("}\n");
+    return(0);
+}
@@ -0,0 +1,24 @@
+#ifndef VIDEO_SOURCE_CPP
+#define VIDEO_SOURCE_CPP
+#include <ctype.h>
+#include <stdlib.h>
+#include <string>
+
+using namespace cv;
+
+//a source that's all digits is a camera number, anything else (0clip.mp4 included) is a file or url
+bool is_camera_source(const char *source)
+{
+    bool is_device = *source != '\0';
+    for(const char *c = source; *c; c++)
+	is_device = is_device && isdigit((unsigned char)*c);
+    return(is_device);
+}
+
+bool open_video_source(VideoCapture &cap, const char *source)
+{
+    if(is_camera_source(source))
+	return(cap.open(atoi(source)));
+    return(cap.open(std::string(source)));
+}
+#endif
@@ -0,0 +1,123 @@
+#ifndef AUGMENT_CPP
+#define AUGMENT_CPP
+#include <stdint.h>
+#include <math.h>
+#include <random>
+
+/*
+  random distortions for training images, so clean glyphs look more like the warped, blurred
+  crops contour_keyboard_tracker hands the classifier. per image:
+    - one homography made of the resize to the output size, a random rotation, scale, shear and
+      shift, and a random jitter of the four corners (perspective), so the image is resampled
+      exactly once by a single warpPerspective however many of those there are
+    - sometimes a gaussian blur of the small output
+    - a random contrast and brightness and some noise, done in the same pass that turns the
+      pixels into floats (pixel * scale + offset) in the batch
+  every random number comes from the rng passed in, which each loader thread has its own of.
+  all the ranges are +-, the shift and the corner jitter are fractions of the output size.
+ */
+struct augment_params
+{
+    bool enabled;
+    float max_rotation;
+    float max_scale;
+    float max_shear;
+    float max_shift;
+    float max_perspective;
+    float blur_probability;
+    float max_blur_sigma;
+    float max_contrast;
+    float max_brightness;
+    float max_noise;
+};
+
+augment_params default_augment_params()
+{
+    augment_params params;
+    params.enabled = false;
+    params.max_rotation = 10.0f;
+    params.max_scale = 0.1f;
+    params.max_shear = 0.15f;
+    params.max_shift = 0.08f;
+    params.max_perspective = 0.08f;
+    params.blur_probability = 0.5f;
+    params.max_blur_sigma = 1.2f;
+    params.max_contrast = 0.3f;
+    params.max_brightness = 30.0f;
+    params.max_noise = 8.0f;
+    return(params);
+}
+
+float uniform(std::mt19937 &rng, float max)
+{
+    return(std::uniform_real_distribution<float>(-max, max)(rng));
+}
+
+//maps source pixels to the size x size output, everything about the warp in one matrix
+Mat augment_transform(Size source, int size, const augment_params *params, std::mt19937 &rng)
+{
+    double c = size / 2.0;
+    Mat to_center = (Mat_<double>(3, 3) <<
+		     (double)size / source.width, 0, -c,
+		     0, (double)size / source.height, -c,
+		     0, 0, 1);
+    double angle = uniform(rng, params->max_rotation) * CV_PI / 180.0;
+    double scale = 1.0 + uniform(rng, params->max_scale);
+    double shear = uniform(rng, params->max_shear);
+    double dx = c + uniform(rng, params->max_shift) * size;
+    double dy = c + uniform(rng, params->max_shift) * size;
+    Mat affine = (Mat_<double>(3, 3) <<
+		  scale * cos(angle), scale * (cos(angle) * shear - sin(angle)), dx,
+		  scale * sin(angle), scale * (sin(angle) * shear + cos(angle)), dy,
+		  0, 0, 1);
+
+    Point2f corners[4] = { Point2f(0, 0), Point2f(size, 0), Point2f(size, size), Point2f(0, size) };
+    Point2f jittered[4];
+    for(int i = 0; i < 4; i++)
+	jittered[i] = corners[i] + Point2f(uniform(rng, params->max_perspective) * size,
+					   uniform(rng, params->max_perspective) * size);
+    Mat perspective = getPerspectiveTransform(corners, jittered);
+    return(perspective * affine * to_center);
+}
+
+/*
+  writes one augmented size x size image into dst as floats. pixels is the 8 bit workspace the
+  warp and blur go through, one per thread so nothing is allocated after the first image.
+ */
+void augment_image(const Mat &source, float *dst, int size, float scale, float offset,
+		   const augment_params *params, std::mt19937 &rng, Mat &pixels)
+{
+    Mat transform = augment_transform(source.size(), size, params, rng);
+    warpPerspective(source, pixels, transform, Size(size, size), INTER_LINEAR, BORDER_REPLICATE);
+
+    if(std::uniform_real_distribution<float>(0.0f, 1.0f)(rng) < params->blur_probability)
+    {
+	float sigma = std::uniform_real_distribution<float>(0.3f, std::max(params->max_blur_sigma, 0.3f))(rng);
+	GaussianBlur(pixels, pixels, Size(0, 0), sigma);
+    }
+
+    float contrast = 1.0f + uniform(rng, params->max_contrast);
+    float brightness = uniform(rng, params->max_brightness);
+    float sigma = std::uniform_real_distribution<float>(0.0f, params->max_noise)(rng);
+    float alpha = contrast * scale;
+    float beta = brightness * scale + offset;
+    //the noise is the sum of two 16 bit uniforms from one draw, triangular rather than gaussian
+    //but with the same standard deviation, and a lot cheaper than normal_distribution per pixel
+    float noise_scale = sigma * scale / (65536.0f * 0.40824829f);
+    float low = offset, high = 255.0f * scale + offset;
+    if(low > high)
+	std::swap(low, high);
+    size_t values = (size_t)size * pixels.channels();
+    for(int y = 0; y < size; y++)
+    {
+	const uchar *p = pixels.ptr<uchar>(y);
+	float *d = dst + y * values;
+	for(size_t i = 0; i < values; i++)
+	{
+	    uint32_t u = rng();
+	    int noise = (int)(u & 0xffff) + (int)(u >> 16) - 65535;
+	    d[i] = std::min(std::max(p[i] * alpha + beta + noise * noise_scale, low), high);
+	}
+    }
+}
+#endif
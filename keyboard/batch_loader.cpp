@@ -0,0 +1,327 @@
+#ifndef BATCH_LOADER_CPP
+#define BATCH_LOADER_CPP
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <algorithm>
+#include "key_dataset.cpp"
+#include "augment.cpp"
+
+/*
+  feeds training mini-batches from a pool of worker threads, so the training step never waits on
+  png decoding. the images come from a key_dataset (already decoded, so a worker only resizes and
+  converts) or from a list of files (a worker imreads them too). every image is resized to
+  size x size and written as floats, pixel * scale + offset, straight into its place in the
+  batch's NHWC tensor, and its label next to it. with params.augment.enabled each image is
+  randomly distorted on the way in instead (augment.cpp), by the worker that loads it, with that
+  worker's own rng. the rng is reseeded from seed, the batch and the position in it before every
+  image, so the distortions are the same from run to run however the images fall to the threads.
+
+  there are BATCH_LOADER_SLOTS batches in flight: while the trainer works on batch b out of one
+  slot, the workers fill b + 1 in the other. within a batch the workers take images one at a time
+  from a shared counter, so a slow png doesn't hold up the others, and batch b always gets
+  workers before b + 1 does. each epoch goes through the images in a new shuffled order (from
+  seed and the epoch number, so runs repeat), and leaves off the last partial batch.
+
+    batch_loader loader;
+    start_batch_loader(&loader, dataset_source(&ds), ds.train, ds.header->train_count, params);
+    for(...)
+    {
+	const loader_batch *batch = next_batch(&loader);
+	...train on batch->data and batch->labels...
+	release_batch(&loader);
+    }
+    stop_batch_loader(&loader);
+ */
+#define BATCH_LOADER_SLOTS 2
+
+struct image_source
+{
+    const key_dataset *dataset;
+    const vector<string> *filenames;
+    const int32_t *labels;
+};
+
+image_source dataset_source(const key_dataset *ds)
+{
+    image_source source = { ds, nullptr, ds->labels };
+    return(source);
+}
+
+//labels may be null, then every label is -1
+image_source file_source(const vector<string> *filenames, const int32_t *labels)
+{
+    image_source source = { nullptr, filenames, labels };
+    return(source);
+}
+
+struct batch_loader_params
+{
+    int batch_size;
+    int image_size;
+    int threads;
+    float scale;
+    float offset;
+    bool shuffle;
+    uint32_t seed;
+    augment_params augment;
+};
+
+batch_loader_params default_batch_loader_params()
+{
+    batch_loader_params params;
+    params.batch_size = 64;
+    params.image_size = KEY_INPUT_SIZE;
+    params.threads = std::max(1u, std::thread::hardware_concurrency());
+    params.scale = 1.0f / 255.0f;
+    params.offset = 0.0f;
+    params.shuffle = true;
+    params.seed = 1234;
+    params.augment = default_augment_params();
+    return(params);
+}
+
+struct loader_batch
+{
+    int number;
+    int epoch;
+    vector<float> data;
+    vector<int32_t> labels;
+};
+
+struct batch_slot
+{
+    loader_batch batch;
+    int claimed;
+    int done;
+};
+
+struct batch_loader
+{
+    image_source source;
+    vector<int32_t> indices;
+    batch_loader_params params;
+    int batches_per_epoch;
+
+    //the shuffled order for two epochs, the one being finished and the one being started
+    vector<int32_t> order[2];
+    int order_epoch[2];
+
+    batch_slot slots[BATCH_LOADER_SLOTS];
+    int next_consume;
+    bool consuming;
+    bool stop;
+    std::mutex lock;
+    std::condition_variable work;
+    std::condition_variable ready;
+    vector<std::thread> workers;
+
+    //throughput: images the workers finished, the time they spent on them, and the time the
+    //trainer spent waiting for them
+    std::chrono::steady_clock::time_point start;
+    int64_t images_loaded;
+    int64_t images_failed;
+    double load_seconds;
+    double wait_seconds;
+};
+
+const vector<int32_t> &epoch_order(batch_loader *l, int epoch)
+{
+    int i = epoch & 1;
+    if(l->order_epoch[i] != epoch)
+    {
+	l->order[i] = l->indices;
+	if(l->params.shuffle)
+	{
+	    std::mt19937 rng(l->params.seed + epoch);
+	    std::shuffle(l->order[i].begin(), l->order[i].end(), rng);
+	}
+	l->order_epoch[i] = epoch;
+    }
+    return(l->order[i]);
+}
+
+/*
+  decodes, resizes (or augments) and converts one image into its place in the batch, false if it
+  couldn't be read. rng and pixels belong to the worker.
+ */
+bool load_batch_image(const batch_loader *l, int index, float *dst, std::mt19937 &rng, Mat &pixels)
+{
+    int size = l->params.image_size;
+    Mat source;
+    if(l->source.dataset)
+	source = dataset_image(l->source.dataset, index);
+    else
+	source = imread((*l->source.filenames)[index], IMREAD_COLOR);
+    Mat out(size, size, CV_32FC3, dst);
+    if(source.empty())
+    {
+	out.setTo(Scalar::all(0));
+	return(false);
+    }
+    if(l->params.augment.enabled)
+    {
+	augment_image(source, dst, size, l->params.scale, l->params.offset, &l->params.augment, rng, pixels);
+	return(true);
+    }
+    if(source.rows != size || source.cols != size)
+    {
+	Mat resized;
+	resize(source, resized, Size(size, size), 0, 0, INTER_AREA);
+	source = resized;
+    }
+    source.convertTo(out, CV_32FC3, l->params.scale, l->params.offset);
+    return(true);
+}
+
+/*
+  hands a worker the next image to load: the lowest numbered batch in flight that still has
+  images nobody has taken, starting that batch in its slot if the slot is free. the caller holds
+  the lock.
+ */
+bool claim_image(batch_loader *l, batch_slot **slot_out, int *position)
+{
+    for(int b = l->next_consume; b < l->next_consume + BATCH_LOADER_SLOTS; b++)
+    {
+	batch_slot *slot = &l->slots[b % BATCH_LOADER_SLOTS];
+	if(slot->batch.number == -1)
+	{
+	    slot->batch.number = b;
+	    slot->batch.epoch = b / l->batches_per_epoch;
+	    slot->claimed = 0;
+	    slot->done = 0;
+	}
+	if(slot->batch.number == b && slot->claimed < l->params.batch_size)
+	{
+	    *slot_out = slot;
+	    *position = slot->claimed++;
+	    return(true);
+	}
+    }
+    return(false);
+}
+
+void batch_loader_worker(batch_loader *l)
+{
+    size_t image_floats = (size_t)l->params.image_size * l->params.image_size * 3;
+    std::mt19937 rng;
+    Mat pixels;
+    std::unique_lock<std::mutex> guard(l->lock);
+    while(true)
+    {
+	batch_slot *slot;
+	int position;
+	l->work.wait(guard, [&]() { return(l->stop || claim_image(l, &slot, &position)); });
+	if(l->stop)
+	    return;
+	loader_batch *batch = &slot->batch;
+	const vector<int32_t> &order = epoch_order(l, batch->epoch);
+	int index = order[(size_t)(batch->number % l->batches_per_epoch) * l->params.batch_size + position];
+	guard.unlock();
+
+	if(l->params.augment.enabled)
+	    rng.seed(l->params.seed ^ ((uint32_t)batch->number * 2654435761u + (uint32_t)position * 40503u));
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool loaded = load_batch_image(l, index, batch->data.data() + position * image_floats, rng, pixels);
+	batch->labels[position] = l->source.labels ? l->source.labels[index] : -1;
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	guard.lock();
+	l->load_seconds += seconds;
+	l->images_loaded++;
+	l->images_failed += !loaded;
+	if(++slot->done == l->params.batch_size)
+	    l->ready.notify_all();
+    }
+}
+
+void start_batch_loader(batch_loader *l, image_source source, const int32_t *indices, int count,
+			batch_loader_params params)
+{
+    CV_Assert(params.batch_size > 0 && count >= params.batch_size && params.threads > 0);
+    //batches are bgr floats, files are always imread as bgr but a dataset keeps whatever it was made with
+    CV_Assert(!source.dataset || source.dataset->header->channels == 3);
+    l->source = source;
+    l->indices.assign(indices, indices + count);
+    l->params = params;
+    l->batches_per_epoch = count / params.batch_size;
+    l->order_epoch[0] = l->order_epoch[1] = -1;
+    size_t batch_floats = (size_t)params.batch_size * params.image_size * params.image_size * 3;
+    for(batch_slot &slot : l->slots)
+    {
+	slot.batch.number = -1;
+	slot.batch.data.assign(batch_floats, 0.0f);
+	slot.batch.labels.assign(params.batch_size, -1);
+    }
+    l->next_consume = 0;
+    l->consuming = false;
+    l->stop = false;
+    l->start = std::chrono::steady_clock::now();
+    l->images_loaded = 0;
+    l->images_failed = 0;
+    l->load_seconds = 0.0;
+    l->wait_seconds = 0.0;
+    for(int i = 0; i < params.threads; i++)
+	l->workers.push_back(std::thread(batch_loader_worker, l));
+}
+
+//waits for the next batch. it's the caller's until release_batch, which must come before the next call.
+const loader_batch *next_batch(batch_loader *l)
+{
+    std::unique_lock<std::mutex> guard(l->lock);
+    CV_Assert(!l->consuming);
+    batch_slot *slot = &l->slots[l->next_consume % BATCH_LOADER_SLOTS];
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    l->ready.wait(guard, [&]() {
+	    return(slot->batch.number == l->next_consume && slot->done == l->params.batch_size); });
+    l->wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    l->consuming = true;
+    return(&slot->batch);
+}
+
+//gives the batch from next_batch back, its slot starts filling with the batch after the one in flight
+void release_batch(batch_loader *l)
+{
+    {
+	std::lock_guard<std::mutex> guard(l->lock);
+	CV_Assert(l->consuming);
+	l->slots[l->next_consume % BATCH_LOADER_SLOTS].batch.number = -1;
+	l->next_consume++;
+	l->consuming = false;
+    }
+    l->work.notify_all();
+}
+
+void stop_batch_loader(batch_loader *l)
+{
+    {
+	std::lock_guard<std::mutex> guard(l->lock);
+	l->stop = true;
+    }
+    l->work.notify_all();
+    for(std::thread &worker : l->workers)
+	worker.join();
+    l->workers.clear();
+}
+
+/*
+  delivered is what the trainer actually got, which a fast loader can't push past the speed of
+  the training step. capacity is what the workers would manage flat out, from how long each image
+  took them.
+ */
+void print_loader_stats(batch_loader *l, FILE *out)
+{
+    std::lock_guard<std::mutex> guard(l->lock);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - l->start).count();
+    double capacity = l->load_seconds > 0.0 ? l->images_loaded * l->params.threads / l->load_seconds : 0.0;
+    fprintf(out, "loader: %lld images (%lld unreadable) in %.2f s on %d threads, %.0f images/s delivered, "
+	    "%.0f images/s capacity, trainer waited %.1f ms (%.1f%%)\n", (long long)l->images_loaded,
+	    (long long)l->images_failed, seconds, l->params.threads, l->images_loaded / seconds, capacity,
+	    l->wait_seconds * 1e3, 100.0 * l->wait_seconds / seconds);
+}
+#endif
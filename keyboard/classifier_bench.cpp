@@ -0,0 +1,105 @@
+#include "key_classifier.cpp"
+#include <chrono>
+#include <random>
+
+//./classifier_bench
+//./classifier_bench keys.kcnn
+
+/*
+  times the key classifier on a batch of crops with sgemm's avx2 and plain kernels, and checks that
+  they agree. with no weights file it writes one with random weights in the shape cnn_model was
+  building (conv 5x5x32, pool, conv 5x5x64, pool, dense 128, dense 62, softmax) and loads that,
+  so the loader gets exercised too.
+ */
+#define BATCH 100
+#define ITERATIONS 10
+
+void write_ints(FILE *f, std::initializer_list<int> values)
+{
+    for(int v : values)
+	fwrite(&v, sizeof(int), 1, f);
+}
+
+void write_random(FILE *f, size_t count, float scale, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> dist(-scale, scale);
+    for(size_t i = 0; i < count; i++)
+    {
+	float v = dist(rng);
+	fwrite(&v, sizeof(float), 1, f);
+    }
+}
+
+bool write_random_classifier(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if(!f)
+	return(false);
+    std::mt19937 rng(1234);
+    fwrite("KCNN", 1, 4, f);
+    write_ints(f, { KEY_CLASSIFIER_VERSION, 28, 3, 10 });
+    write_ints(f, { LAYER_CONV, 3, 32, 5 });
+    write_random(f, 32 * 5 * 5 * 3, 0.2f, rng);
+    write_random(f, 32, 0.1f, rng);
+    write_ints(f, { LAYER_RELU, LAYER_MAXPOOL, 2 });
+    write_ints(f, { LAYER_CONV, 32, 64, 5 });
+    write_random(f, 64 * 5 * 5 * 32, 0.05f, rng);
+    write_random(f, 64, 0.1f, rng);
+    write_ints(f, { LAYER_RELU, LAYER_MAXPOOL, 2 });
+    write_ints(f, { LAYER_DENSE, 7 * 7 * 64, 128 });
+    write_random(f, 128 * 7 * 7 * 64, 0.02f, rng);
+    write_random(f, 128, 0.1f, rng);
+    write_ints(f, { LAYER_RELU });
+    write_ints(f, { LAYER_DENSE, 128, 62 });
+    write_random(f, 62 * 128, 0.1f, rng);
+    write_random(f, 62, 0.1f, rng);
+    write_ints(f, { LAYER_SOFTMAX });
+    fclose(f);
+    return(true);
+}
+
+double time_classifier(const key_classifier *model, const std::vector<uint8_t> &crops, cnn_workspace *ws,
+		       std::vector<float> &probabilities, gemm_micro_kernel micro)
+{
+    run_key_classifier(model, crops.data(), BATCH, ws, probabilities, micro);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < ITERATIONS; i++)
+	run_key_classifier(model, crops.data(), BATCH, ws, probabilities, micro);
+    return(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / ITERATIONS);
+}
+
+int main(int argc, char** argv)
+{
+    const char *path = argc > 1 ? argv[1] : "random_keys.kcnn";
+    if(argc <= 1 && !write_random_classifier(path))
+    {
+	fprintf(stderr, "couldn't write %s\n", path);
+	return(-1);
+    }
+    key_classifier model;
+    if(!load_key_classifier(path, &model))
+	return(-1);
+
+    std::mt19937 rng(4321);
+    std::vector<uint8_t> crops((size_t)BATCH * model.input_size * model.input_size * model.input_channels);
+    for(uint8_t &c : crops)
+	c = rng() & 0xff;
+
+    cnn_workspace ws;
+    std::vector<float> reference, probabilities;
+    double scalar_ms = time_classifier(&model, crops, &ws, reference, gemm_micro_scalar);
+    printf("%d crops, %d classes\n", BATCH, classifier_outputs(&model));
+    printf("%-8s %10.3f ms/batch %8.4f ms/key\n", "scalar", scalar_ms, scalar_ms / BATCH);
+#ifdef GEMM_X86
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+	double avx2_ms = time_classifier(&model, crops, &ws, probabilities, gemm_micro_avx2);
+	float diff = 0.0f;
+	for(size_t i = 0; i < reference.size(); i++)
+	    diff = std::max(diff, fabsf(reference[i] - probabilities[i]));
+	printf("%-8s %10.3f ms/batch %8.4f ms/key  %.1fx, max difference %g\n", "avx2", avx2_ms, avx2_ms / BATCH,
+	       scalar_ms / avx2_ms, diff);
+    }
+#endif
+    return(0);
+}
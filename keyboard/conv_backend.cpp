@@ -0,0 +1,586 @@
+#ifndef CONV_BACKEND_CPP
+#define CONV_BACKEND_CPP
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "key_classifier.cpp"
+#include "gemm.cpp"
+
+/*
+  the ways the trainer can run a 'same' convolution layer forwards and backwards, over count
+  NHWC images at once, with weights [ky][kx][in][out] as key_classifier.cpp keeps them:
+
+  CONV_ROWS      one image at a time, k overlapping matrix multiplies per output row, the way
+                 key_classifier.cpp's convolve does it. no copies, but the multiplies are small.
+  CONV_IM2COL    the whole layer over all the images as one matrix multiply: every output pixel
+                 of every image gets a row holding the k x k x c inputs under it (im2col), and
+                 that times the weights is the output. the weight gradient is the transposed rows
+                 times the output gradient, and the input gradient is the output gradient times
+                 the transposed weights, added back under each pixel (col2im). each is one gemm.
+  CONV_WINOGRAD  winograd F(m x m, k x k) with 6 x 6 tiles, so F(4x4, 3x3) and F(2x2, 5x5): the
+                 image is cut into 6 x 6 tiles overlapping by k - 1, both tiles and weights are
+                 transformed, and the convolution becomes 36 matrix multiplies of (tiles x in) by
+                 (in x out), one per tile position, followed by the inverse transform. that's 36
+                 multiplies for 4 x 4 outputs of a 3x3 kernel instead of 144, 36 for 2 x 2 outputs
+                 of a 5x5 one instead of 100. the input gradient is the same thing run on the
+                 output gradient with the kernel flipped and in and out swapped, the weight
+                 gradient is done the rows way. layers it doesn't pay on (see winograd_supports)
+                 run the rows way.
+
+  the transforms come from the cook-toom points 0, 1, -1, 2, -2 and infinity (see
+  make_winograd_transform). 2 and -2 make 4x4 outputs of 3x3 kernels lose a couple of bits
+  against im2col, which is fine for training in floats.
+ */
+enum { CONV_ROWS, CONV_IM2COL, CONV_WINOGRAD, CONV_BACKENDS };
+#define WINOGRAD_ALPHA 6
+//how many tiles go through the transforms and the 36 gemms at once, so they stay in cache
+#define WINOGRAD_MAX_TILES 2048
+#define WINOGRAD_MIN_CHANNELS 16
+
+const char *conv_backend_names[CONV_BACKENDS] = { "rows", "im2col", "winograd" };
+
+//-1 if there is no backend by that name
+int conv_backend_by_name(const char *name)
+{
+    for(int i = 0; i < CONV_BACKENDS; i++)
+	if(strcmp(name, conv_backend_names[i]) == 0)
+	    return(i);
+    return(-1);
+}
+
+/*
+  winograd only has transforms for 3x3 and 5x5, and with only a few input channels the tile
+  transforms cost more than the multiplies they save (a 3 channel first layer runs several
+  times slower than rows), so those layers run the rows way.
+ */
+bool winograd_supports(const cnn_layer *l)
+{
+    return((l->kernel == 3 || l->kernel == 5) && l->in_channels >= WINOGRAD_MIN_CHANNELS);
+}
+
+//the backend that actually runs a layer
+int conv_backend_for(int backend, const cnn_layer *l)
+{
+    return(backend == CONV_WINOGRAD && !winograd_supports(l) ? CONV_ROWS : backend);
+}
+
+/*
+  y = at * ((g * w) . (bt * d)) for m outputs of an r tap correlation over WINOGRAD_ALPHA inputs,
+  and the same on both axes in 2d. with the points p_0..p_4 and infinity, g evaluates the kernel
+  polynomial at the points, at evaluates the output one, and bt is the transposed interpolation
+  (the inverse of the evaluation matrix), because correlation is the transpose of the polynomial
+  product toom-cook computes.
+ */
+struct winograd_transform
+{
+    int m;
+    int r;
+    float at[WINOGRAD_ALPHA][WINOGRAD_ALPHA];
+    float g[WINOGRAD_ALPHA][WINOGRAD_ALPHA];
+    float bt[WINOGRAD_ALPHA][WINOGRAD_ALPHA];
+};
+
+winograd_transform make_winograd_transform(int r)
+{
+    const int n = WINOGRAD_ALPHA;
+    const double points[n - 1] = { 0.0, 1.0, -1.0, 2.0, -2.0 };
+    winograd_transform t;
+    memset(&t, 0, sizeof(t));
+    t.r = r;
+    t.m = n - r + 1;
+
+    //evaluation matrix of a degree n - 1 polynomial, inverted next to an identity
+    double v[n][2 * n];
+    for(int j = 0; j < n; j++)
+    {
+	for(int k = 0; k < n; k++)
+	{
+	    v[j][k] = j < n - 1 ? pow(points[j], k) : k == n - 1;
+	    v[j][n + k] = j == k;
+	}
+    }
+    for(int col = 0; col < n; col++)
+    {
+	int pivot = col;
+	for(int j = col + 1; j < n; j++)
+	    if(fabs(v[j][col]) > fabs(v[pivot][col]))
+		pivot = j;
+	for(int k = 0; k < 2 * n; k++)
+	    std::swap(v[col][k], v[pivot][k]);
+	double scale = v[col][col];
+	for(int k = 0; k < 2 * n; k++)
+	    v[col][k] /= scale;
+	for(int j = 0; j < n; j++)
+	{
+	    double f = v[j][col];
+	    if(j == col || f == 0.0)
+		continue;
+	    for(int k = 0; k < 2 * n; k++)
+		v[j][k] -= f * v[col][k];
+	}
+    }
+
+    for(int j = 0; j < n; j++)
+    {
+	for(int i = 0; i < t.m; i++)
+	    t.at[i][j] = j < n - 1 ? pow(points[j], i) : i == t.m - 1;
+	for(int k = 0; k < r; k++)
+	    t.g[j][k] = j < n - 1 ? pow(points[j], k) : k == r - 1;
+	//the inverse has a few 1e-17s where there should be zeros, which would cost a multiply each
+	for(int k = 0; k < n; k++)
+	    t.bt[j][k] = fabs(v[k][n + j]) < 1e-9 ? 0.0f : v[k][n + j];
+    }
+    return(t);
+}
+
+const winograd_transform *winograd_for(int kernel)
+{
+    static const winograd_transform f4x3 = make_winograd_transform(3);
+    static const winograd_transform f2x5 = make_winograd_transform(5);
+    return(kernel == 3 ? &f4x3 : &f2x5);
+}
+
+//what a layer's weights turn into for the backend, redone whenever the weights change
+struct conv_weights
+{
+    //[out][ky][kx][in], for the input gradient
+    std::vector<float> transposed;
+    //[36][in][out] and, flipped with in and out swapped, [36][out][in]
+    std::vector<float> winograd;
+    std::vector<float> winograd_flipped;
+};
+
+//scratch for one thread, grown to the biggest layer and batch it has seen
+struct conv_workspace
+{
+    std::vector<float> padded;
+    std::vector<float> wide;
+    std::vector<float> padded_delta;
+    std::vector<float> columns;
+    std::vector<float> delta_t;
+    std::vector<float> gradient_t;
+    std::vector<float> gradient;
+    std::vector<float> row_delta;
+    std::vector<float> tile;
+    std::vector<float> transformed;
+    std::vector<float> products;
+    gemm_workspace gemm;
+};
+
+/*
+  dst += f * src. the loops over channels are all this, and in blocks of 8 with restrict the
+  compiler vectorizes them at -O2 (where it won't add the alias checks and the tail it needs for
+  the plain loop).
+ */
+inline void add_scaled(float *__restrict dst, const float *__restrict src, float f, int n)
+{
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+	for(int j = 0; j < 8; j++)
+	    dst[i + j] += f * src[i + j];
+    for(; i < n; i++)
+	dst[i] += f * src[i];
+}
+
+//u[36][in][out] = g * w * g^T for every in, out pair, w is [r][r][in][out] (or [r][r][pairs])
+void winograd_weights(const float *w, int r, int pairs, float *u)
+{
+    const winograd_transform *t = winograd_for(r);
+    std::fill(u, u + (size_t)WINOGRAD_ALPHA * WINOGRAD_ALPHA * pairs, 0.0f);
+    for(int a = 0; a < WINOGRAD_ALPHA; a++)
+    {
+	for(int b = 0; b < WINOGRAD_ALPHA; b++)
+	{
+	    float *dst = u + (size_t)(a * WINOGRAD_ALPHA + b) * pairs;
+	    for(int ky = 0; ky < r; ky++)
+	    {
+		for(int kx = 0; kx < r; kx++)
+		{
+		    float f = t->g[a][ky] * t->g[b][kx];
+		    if(f == 0.0f)
+			continue;
+		    add_scaled(dst, w + (size_t)(ky * r + kx) * pairs, f, pairs);
+		}
+	    }
+	}
+    }
+}
+
+void prepare_conv_weights(int backend, const cnn_layer *l, conv_weights *w)
+{
+    int k = l->kernel;
+    int taps = k * k * l->in_channels;
+    backend = conv_backend_for(backend, l);
+    w->transposed.resize(l->weights.size());
+    transpose_blocked(l->weights.data(), taps, l->out_channels, w->transposed.data());
+    if(backend != CONV_WINOGRAD)
+	return;
+    int pairs = l->in_channels * l->out_channels;
+    w->winograd.resize((size_t)WINOGRAD_ALPHA * WINOGRAD_ALPHA * pairs);
+    winograd_weights(l->weights.data(), k, pairs, w->winograd.data());
+
+    //w[k - 1 - ky][k - 1 - kx][in][out] as [ky][kx][out][in], the kernel the input gradient is convolved with
+    std::vector<float> flipped(l->weights.size());
+    int in = l->in_channels, out = l->out_channels;
+    for(int ky = 0; ky < k; ky++)
+	for(int kx = 0; kx < k; kx++)
+	    transpose_blocked(l->weights.data() + (size_t)((k - 1 - ky) * k + k - 1 - kx) * pairs, in, out,
+			      flipped.data() + (size_t)(ky * k + kx) * pairs);
+    w->winograd_flipped.resize(w->winograd.size());
+    winograd_weights(flipped.data(), k, pairs, w->winograd_flipped.data());
+}
+
+/*
+  winograd convolution of count images of in channels into out channels with the transformed
+  weights u [36][in][out]. bias may be null. in is read through a zero padded copy one tile at a
+  time, so images don't need padding first.
+ */
+void winograd_convolve(const float *input, int count, int size, int in, int out, int r, const float *u,
+		       const float *bias, float *output, conv_workspace *ws, gemm_micro_kernel micro)
+{
+    const int n = WINOGRAD_ALPHA;
+    const winograd_transform *t = winograd_for(r);
+    int m = t->m;
+    int pad = r / 2;
+    int tiles_side = (size + m - 1) / m;
+    int tiles_image = tiles_side * tiles_side;
+    int padded_side = tiles_side * m + r - 1;
+    int group = std::max(1, std::min(count, WINOGRAD_MAX_TILES / tiles_image));
+    size_t per_image = (size_t)size * size * in;
+
+    ws->padded.resize((size_t)padded_side * padded_side * in);
+    ws->tile.resize((size_t)n * n * std::max(in, out));
+    ws->transformed.resize((size_t)n * n * group * tiles_image * in);
+    ws->products.resize((size_t)n * n * group * tiles_image * out);
+    float *tile = ws->tile.data();
+    for(int first = 0; first < count; first += group)
+    {
+	int images = std::min(group, count - first);
+	int tiles = images * tiles_image;
+	float *v = ws->transformed.data();
+	float *mp = ws->products.data();
+
+	//v[a][b][tile][in] = bt * d * b for each tile d of each image
+	for(int i = 0; i < images; i++)
+	{
+	    float *padded = ws->padded.data();
+	    std::fill(ws->padded.begin(), ws->padded.end(), 0.0f);
+	    const float *image = input + (first + i) * per_image;
+	    for(int y = 0; y < size; y++)
+		memcpy(padded + ((size_t)(y + pad) * padded_side + pad) * in, image + (size_t)y * size * in,
+		       (size_t)size * in * sizeof(float));
+	    for(int ty = 0; ty < tiles_side; ty++)
+	    {
+		for(int tx = 0; tx < tiles_side; tx++)
+		{
+		    //tile[a][x][in] = sum over y of bt[a][y] * d[y][x][in]
+		    std::fill(tile, tile + (size_t)n * n * in, 0.0f);
+		    for(int a = 0; a < n; a++)
+		    {
+			for(int y = 0; y < n; y++)
+			{
+			    float f = t->bt[a][y];
+			    if(f == 0.0f)
+				continue;
+			    add_scaled(tile + (size_t)a * n * in,
+				       padded + ((size_t)(ty * m + y) * padded_side + tx * m) * in, f, n * in);
+			}
+		    }
+		    size_t index = (size_t)i * tiles_image + ty * tiles_side + tx;
+		    for(int a = 0; a < n; a++)
+		    {
+			for(int b = 0; b < n; b++)
+			{
+			    float *dst = v + ((size_t)(a * n + b) * tiles + index) * in;
+			    std::fill(dst, dst + in, 0.0f);
+			    for(int x = 0; x < n; x++)
+			    {
+				float f = t->bt[b][x];
+				if(f == 0.0f)
+				    continue;
+				add_scaled(dst, tile + (size_t)(a * n + x) * in, f, in);
+			    }
+			}
+		    }
+		}
+	    }
+	}
+
+	for(int p = 0; p < n * n; p++)
+	    sgemm(tiles, out, in, v + (size_t)p * tiles * in, in, u + (size_t)p * in * out, out,
+		  mp + (size_t)p * tiles * out, out, false, &ws->gemm, micro);
+
+	//y = at * m * a back into the image, plus the bias
+	for(int index = 0; index < tiles; index++)
+	{
+	    int i = index / tiles_image;
+	    int ty = index % tiles_image / tiles_side;
+	    int tx = index % tiles_side;
+	    float *image = output + (size_t)(first + i) * size * size * out;
+	    //tile[o][b][out] = sum over a of at[o][a] * m[a][b]
+	    std::fill(tile, tile + (size_t)m * n * out, 0.0f);
+	    for(int o = 0; o < m; o++)
+	    {
+		for(int a = 0; a < n; a++)
+		{
+		    float f = t->at[o][a];
+		    if(f == 0.0f)
+			continue;
+		    for(int b = 0; b < n; b++)
+		    {
+			add_scaled(tile + (size_t)(o * n + b) * out, mp + ((size_t)(a * n + b) * tiles + index) * out,
+				   f, out);
+		    }
+		}
+	    }
+	    for(int oy = 0; oy < m && ty * m + oy < size; oy++)
+	    {
+		for(int ox = 0; ox < m && tx * m + ox < size; ox++)
+		{
+		    float *dst = image + ((size_t)(ty * m + oy) * size + tx * m + ox) * out;
+		    for(int c = 0; c < out; c++)
+			dst[c] = bias ? bias[c] : 0.0f;
+		    for(int b = 0; b < n; b++)
+		    {
+			float f = t->at[ox][b];
+			if(f == 0.0f)
+			    continue;
+			add_scaled(dst, tile + (size_t)(oy * n + b) * out, f, out);
+		    }
+		}
+	    }
+	}
+    }
+}
+
+//columns[image][y][x][ky][kx][in], the inputs under every output pixel of every image
+void im2col(const float *input, int count, int size, int in, int k, float *columns, conv_workspace *ws)
+{
+    int pad = k / 2;
+    int padded_side = size + k - 1;
+    int row_k = k * in;
+    size_t per_image = (size_t)size * size * in;
+    ws->padded.resize((size_t)padded_side * padded_side * in);
+    for(int i = 0; i < count; i++)
+    {
+	pad_image(input + i * per_image, size, in, pad, ws->padded.data());
+	for(int y = 0; y < size; y++)
+	{
+	    for(int x = 0; x < size; x++)
+	    {
+		float *row = columns + (((size_t)i * size + y) * size + x) * k * row_k;
+		for(int ky = 0; ky < k; ky++)
+		    memcpy(row + ky * row_k, ws->padded.data() + ((size_t)(y + ky) * padded_side + x) * in,
+			   row_k * sizeof(float));
+	    }
+	}
+    }
+}
+
+//the other way: every row added back under its pixel, and the padding cut off
+void col2im(const float *columns, int count, int size, int in, int k, float *output, conv_workspace *ws)
+{
+    int pad = k / 2;
+    int padded_side = size + k - 1;
+    int row_k = k * in;
+    size_t per_image = (size_t)size * size * in;
+    ws->padded_delta.resize((size_t)padded_side * padded_side * in);
+    float *padded = ws->padded_delta.data();
+    for(int i = 0; i < count; i++)
+    {
+	std::fill(ws->padded_delta.begin(), ws->padded_delta.end(), 0.0f);
+	for(int y = 0; y < size; y++)
+	{
+	    for(int x = 0; x < size; x++)
+	    {
+		const float *row = columns + (((size_t)i * size + y) * size + x) * k * row_k;
+		for(int ky = 0; ky < k; ky++)
+		{
+		    add_scaled(padded + ((size_t)(y + ky) * padded_side + x) * in, row + ky * row_k, 1.0f, row_k);
+		}
+	    }
+	}
+	for(int y = 0; y < size; y++)
+	    memcpy(output + i * per_image + (size_t)y * size * in,
+		   padded + ((size_t)(y + pad) * padded_side + pad) * in, (size_t)size * in * sizeof(float));
+    }
+}
+
+//out = conv(in) + bias for count images
+void conv_forward(int backend, const cnn_layer *l, const conv_weights *w, const float *input, int count,
+		  int size, float *output, conv_workspace *ws, gemm_micro_kernel micro)
+{
+    int k = l->kernel;
+    int in = l->in_channels, out = l->out_channels;
+    int taps = k * k * in;
+    size_t pixels = (size_t)count * size * size;
+    switch(conv_backend_for(backend, l))
+    {
+    case CONV_ROWS:
+    {
+	int padded_side = size + k - 1;
+	ws->padded.resize((size_t)padded_side * padded_side * in);
+	for(int i = 0; i < count; i++)
+	{
+	    pad_image(input + (size_t)i * size * size * in, size, in, k / 2, ws->padded.data());
+	    convolve(ws->padded.data(), size, in, l, output + (size_t)i * size * size * out, ws->wide, &ws->gemm,
+		     micro);
+	}
+	break;
+    }
+    case CONV_IM2COL:
+	ws->columns.resize(pixels * taps);
+	im2col(input, count, size, in, k, ws->columns.data(), ws);
+	fill_bias(output, l->bias.data(), pixels, out);
+	sgemm(pixels, out, taps, ws->columns.data(), taps, l->weights.data(), out, output, out, true, &ws->gemm, micro);
+	break;
+    case CONV_WINOGRAD:
+	winograd_convolve(input, count, size, in, out, k, w->winograd.data(), l->bias.data(), output, ws, micro);
+	break;
+    }
+}
+
+/*
+  the rows way, per image what the forward pass did turned around. for kernel row ky the weight
+  gradient is columns^T * delta over the image, with columns the k x in inputs under every pixel
+  for that row.
+ */
+void rows_weight_gradient(const cnn_layer *l, const float *input, const float *delta, int count, int size,
+			  float *dw, conv_workspace *ws, gemm_micro_kernel micro)
+{
+    int k = l->kernel;
+    int in = l->in_channels, out = l->out_channels;
+    int row_k = k * in;
+    int padded_side = size + k - 1;
+    int pixels = size * size;
+    ws->padded.resize((size_t)padded_side * padded_side * in);
+    ws->columns.resize((size_t)row_k * pixels);
+    float *columns = ws->columns.data();
+    for(int i = 0; i < count; i++)
+    {
+	pad_image(input + (size_t)i * pixels * in, size, in, k / 2, ws->padded.data());
+	for(int ky = 0; ky < k; ky++)
+	{
+	    for(int y = 0; y < size; y++)
+	    {
+		for(int x = 0; x < size; x++)
+		{
+		    const float *p = ws->padded.data() + ((size_t)(y + ky) * padded_side + x) * in;
+		    float *column = columns + y * size + x;
+		    for(int j = 0; j < row_k; j++)
+			column[(size_t)j * pixels] = p[j];
+		}
+	    }
+	    sgemm(row_k, out, pixels, columns, pixels, delta + (size_t)i * pixels * out, out,
+		  dw + (size_t)ky * row_k * out, out, true, &ws->gemm, micro);
+	}
+    }
+}
+
+//the input gradient of output row y is delta's row times the transposed weights, added onto padded row y + ky
+void rows_input_gradient(const cnn_layer *l, const conv_weights *w, const float *delta, int count, int size,
+			 float *dinput, conv_workspace *ws, gemm_micro_kernel micro)
+{
+    int k = l->kernel;
+    int in = l->in_channels, out = l->out_channels;
+    int row_k = k * in;
+    int padded_side = size + k - 1;
+    size_t per_image = (size_t)size * size * in;
+    ws->padded_delta.resize((size_t)padded_side * padded_side * in);
+    ws->row_delta.resize((size_t)size * row_k);
+    float *padded_delta = ws->padded_delta.data();
+    for(int i = 0; i < count; i++)
+    {
+	const float *d = delta + (size_t)i * size * size * out;
+	std::fill(ws->padded_delta.begin(), ws->padded_delta.end(), 0.0f);
+	for(int y = 0; y < size; y++)
+	{
+	    for(int ky = 0; ky < k; ky++)
+	    {
+		sgemm(size, row_k, out, d + (size_t)y * size * out, out, w->transposed.data() + ky * row_k, k * row_k,
+		      ws->row_delta.data(), row_k, false, &ws->gemm, micro);
+		for(int x = 0; x < size; x++)
+		    add_scaled(padded_delta + ((size_t)(y + ky) * padded_side + x) * in,
+			       ws->row_delta.data() + (size_t)x * row_k, 1.0f, row_k);
+	    }
+	}
+	for(int y = 0; y < size; y++)
+	    memcpy(dinput + i * per_image + (size_t)y * size * in,
+		   padded_delta + ((size_t)(y + k / 2) * padded_side + k / 2) * in, (size_t)size * in * sizeof(float));
+    }
+}
+
+/*
+  dw += columns^T * delta as one gemm over every pixel of every image, done as delta^T * columns
+  so it's the output gradient that gets transposed rather than the k x k times bigger columns
+ */
+void im2col_weight_gradient(const cnn_layer *l, const float *input, const float *delta, int count, int size,
+			    float *dw, conv_workspace *ws, gemm_micro_kernel micro)
+{
+    int k = l->kernel;
+    int in = l->in_channels, out = l->out_channels;
+    int taps = k * k * in;
+    int pixels = count * size * size;
+    ws->columns.resize((size_t)pixels * taps);
+    ws->delta_t.resize((size_t)pixels * out);
+    ws->gradient_t.resize((size_t)out * taps);
+    ws->gradient.resize(ws->gradient_t.size());
+    im2col(input, count, size, in, k, ws->columns.data(), ws);
+    transpose_blocked(delta, pixels, out, ws->delta_t.data());
+    sgemm(out, taps, pixels, ws->delta_t.data(), pixels, ws->columns.data(), taps, ws->gradient_t.data(), taps,
+	  false, &ws->gemm, micro);
+    transpose_blocked(ws->gradient_t.data(), out, taps, ws->gradient.data());
+    add_scaled(dw, ws->gradient.data(), 1.0f, out * taps);
+}
+
+//the columns' gradient is delta * w^T, one gemm, which col2im adds back under each pixel
+void im2col_input_gradient(const cnn_layer *l, const conv_weights *w, const float *delta, int count, int size,
+			   float *dinput, conv_workspace *ws, gemm_micro_kernel micro)
+{
+    int k = l->kernel;
+    int in = l->in_channels, out = l->out_channels;
+    int taps = k * k * in;
+    int pixels = count * size * size;
+    ws->columns.resize((size_t)pixels * taps);
+    sgemm(pixels, taps, out, delta, out, w->transposed.data(), taps, ws->columns.data(), taps, false, &ws->gemm, micro);
+    col2im(ws->columns.data(), count, size, in, k, dinput, ws);
+}
+
+/*
+  the gradients for count images: dw and db are added to, dinput (may be null) is overwritten.
+  winograd has no gain to give the weight gradient (the kernel is the size x size output
+  gradient there), so it does that the rows way, which measures faster than im2col.
+ */
+void conv_backward(int backend, const cnn_layer *l, const conv_weights *w, const float *input, const float *delta,
+		   int count, int size, float *dw, float *db, float *dinput, conv_workspace *ws,
+		   gemm_micro_kernel micro)
+{
+    int out = l->out_channels;
+    int pixels = count * size * size;
+    for(int p = 0; p < pixels; p++)
+	for(int c = 0; c < out; c++)
+	    db[c] += delta[(size_t)p * out + c];
+
+    switch(conv_backend_for(backend, l))
+    {
+    case CONV_ROWS:
+	rows_weight_gradient(l, input, delta, count, size, dw, ws, micro);
+	if(dinput)
+	    rows_input_gradient(l, w, delta, count, size, dinput, ws, micro);
+	break;
+    case CONV_IM2COL:
+	im2col_weight_gradient(l, input, delta, count, size, dw, ws, micro);
+	if(dinput)
+	    im2col_input_gradient(l, w, delta, count, size, dinput, ws, micro);
+	break;
+    case CONV_WINOGRAD:
+	rows_weight_gradient(l, input, delta, count, size, dw, ws, micro);
+	if(dinput)
+	    winograd_convolve(delta, count, size, out, l->in_channels, l->kernel, w->winograd_flipped.data(), nullptr,
+			      dinput, ws, micro);
+	break;
+    }
+}
+#endif
@@ -0,0 +1,202 @@
+#include "opencv2/imgproc/imgproc.hpp"
+#include "trainer.cpp"
+#include <stdio.h>
+#include <chrono>
+
+using namespace std;
+using namespace cv;
+
+//./conv_bench
+//./conv_bench 64
+
+/*
+  times the convolution backends against the filter2D way neural_net.bak.cpp convolves (one
+  filter2D per input channel per filter, summed), forwards and backwards, on the conv layers of
+  the key classifier and a 3x3 one, over a batch of random images, and checks every backend's
+  outputs and gradients against filter2D's. filter2D gets planar Mats, made before the clock
+  starts. its borders are zeros here, as 'same' padding has to be for the gradients to be right.
+  backwards is the weight gradient (the input correlated with the output gradient, a filter2D
+  with the size x size output gradient as the kernel) and the input gradient (the output
+  gradient convolved with the flipped kernels).
+ */
+#define MIN_SECONDS 0.5
+
+struct bench_layer
+{
+    int size;
+    int in;
+    int out;
+    int kernel;
+};
+
+//best of as many calls as fit in MIN_SECONDS, in ms
+template<typename F>
+double best_ms(F f)
+{
+    f();
+    double best = 1e30, total = 0.0;
+    do
+    {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	f();
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	best = std::min(best, ms);
+	total += ms;
+    }
+    while(total < MIN_SECONDS * 1e3);
+    return(best);
+}
+
+//count NHWC images as count * channels planar Mats
+vector<Mat> planes(const vector<float> &nhwc, int count, int size, int channels)
+{
+    vector<Mat> result;
+    for(int i = 0; i < count; i++)
+    {
+	Mat image(size, size, CV_32FC(channels), (void *)(nhwc.data() + (size_t)i * size * size * channels));
+	vector<Mat> split_image;
+	split(image, split_image);
+	result.insert(result.end(), split_image.begin(), split_image.end());
+    }
+    return(result);
+}
+
+vector<float> nhwc(const vector<Mat> &planar, int count, int size, int channels)
+{
+    vector<float> result((size_t)count * size * size * channels);
+    for(int i = 0; i < count; i++)
+    {
+	Mat image(size, size, CV_32FC(channels), result.data() + (size_t)i * size * size * channels);
+	merge(vector<Mat>(planar.begin() + i * channels, planar.begin() + (i + 1) * channels), image);
+    }
+    return(result);
+}
+
+//the largest difference from the reference, relative to the reference's largest value
+double difference(const vector<float> &a, const vector<float> &reference)
+{
+    double error = 0.0, scale = 1e-30;
+    for(size_t i = 0; i < a.size(); i++)
+    {
+	error = std::max(error, (double)fabs(a[i] - reference[i]));
+	scale = std::max(scale, (double)fabs(reference[i]));
+    }
+    return(error / scale);
+}
+
+void bench(const bench_layer &b, int count)
+{
+    std::mt19937 rng(1234);
+    key_classifier model;
+    add_layer(&model, LAYER_CONV, b.in, b.out, b.kernel, 0, rng);
+    cnn_layer &l = model.layers[0];
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    for(float &v : l.bias)
+	v = normal(rng);
+    int k = b.kernel, pad = k / 2;
+    vector<float> input((size_t)count * b.size * b.size * b.in), delta((size_t)count * b.size * b.size * b.out);
+    for(float &v : input)
+	v = normal(rng);
+    for(float &v : delta)
+	v = normal(rng);
+
+    //filter2D's kernels: kernels[o * in + i] is in channel i's k x k for out channel o
+    vector<Mat> kernels, flipped;
+    for(int o = 0; o < b.out; o++)
+    {
+	for(int i = 0; i < b.in; i++)
+	{
+	    Mat kernel(k, k, CV_32F);
+	    for(int ky = 0; ky < k; ky++)
+		for(int kx = 0; kx < k; kx++)
+		    kernel.at<float>(ky, kx) = l.weights[((size_t)(ky * k + kx) * b.in + i) * b.out + o];
+	    kernels.push_back(kernel);
+	    Mat f;
+	    flip(kernel, f, -1);
+	    flipped.push_back(f);
+	}
+    }
+    vector<Mat> in_planes = planes(input, count, b.size, b.in), delta_planes = planes(delta, count, b.size, b.out);
+    vector<Mat> out_planes(count * b.out), din_planes(count * b.in), dw_planes(b.out * b.in);
+
+    double filter_forward = best_ms([&]() {
+	    Mat response;
+	    for(int n = 0; n < count; n++)
+	    {
+		for(int o = 0; o < b.out; o++)
+		{
+		    Mat &sum = out_planes[n * b.out + o];
+		    sum = Mat(b.size, b.size, CV_32F, Scalar::all(l.bias[o]));
+		    for(int i = 0; i < b.in; i++)
+		    {
+			filter2D(in_planes[n * b.in + i], response, CV_32F, kernels[o * b.in + i], Point(-1, -1), 0,
+				 BORDER_CONSTANT);
+			sum += response;
+		    }
+		}
+	    }
+	});
+    double filter_backward = best_ms([&]() {
+	    Mat response, padded;
+	    for(Mat &m : dw_planes)
+		m = Mat::zeros(k, k, CV_32F);
+	    for(int n = 0; n < count; n++)
+	    {
+		for(int i = 0; i < b.in; i++)
+		{
+		    Mat &sum = din_planes[n * b.in + i];
+		    sum = Mat::zeros(b.size, b.size, CV_32F);
+		    copyMakeBorder(in_planes[n * b.in + i], padded, pad, pad, pad, pad, BORDER_CONSTANT, Scalar::all(0));
+		    for(int o = 0; o < b.out; o++)
+		    {
+			const Mat &d = delta_planes[n * b.out + o];
+			filter2D(d, response, CV_32F, flipped[o * b.in + i], Point(-1, -1), 0, BORDER_CONSTANT);
+			sum += response;
+			filter2D(padded, response, CV_32F, d, Point(0, 0), 0, BORDER_CONSTANT);
+			dw_planes[o * b.in + i] += response(Rect(0, 0, k, k));
+		    }
+		}
+	    }
+	});
+    vector<float> reference_out = nhwc(out_planes, count, b.size, b.out);
+    vector<float> reference_din = nhwc(din_planes, count, b.size, b.in);
+    vector<float> reference_dw(l.weights.size());
+    for(int o = 0; o < b.out; o++)
+	for(int i = 0; i < b.in; i++)
+	    for(int ky = 0; ky < k; ky++)
+		for(int kx = 0; kx < k; kx++)
+		    reference_dw[((size_t)(ky * k + kx) * b.in + i) * b.out + o] = dw_planes[o * b.in + i].at<float>(ky, kx);
+
+    printf("%dx%d, %d -> %d channels, %dx%d kernel, %d images\n", b.size, b.size, b.in, b.out, k, k, count);
+    printf("  %-9s forward %8.2f ms  backward %8.2f ms\n", "filter2D", filter_forward, filter_backward);
+    gemm_micro_kernel micro = best_gemm_micro_kernel();
+    for(int backend = 0; backend < CONV_BACKENDS; backend++)
+    {
+	conv_weights weights;
+	conv_workspace ws;
+	vector<float> out(delta.size()), din(input.size()), dw(l.weights.size()), db(b.out);
+	double prepare = best_ms([&]() { prepare_conv_weights(backend, &l, &weights); });
+	double forward = best_ms([&]() {
+		conv_forward(backend, &l, &weights, input.data(), count, b.size, out.data(), &ws, micro); });
+	double backward = best_ms([&]() {
+		std::fill(dw.begin(), dw.end(), 0.0f);
+		conv_backward(backend, &l, &weights, input.data(), delta.data(), count, b.size, dw.data(), db.data(),
+			      din.data(), &ws, micro); });
+	const char *ran = conv_backend_names[conv_backend_for(backend, &l)];
+	printf("  %-9s forward %8.2f ms (%5.1fx)  backward %8.2f ms (%5.1fx)  weights %.3f ms  "
+	       "differences %.1e %.1e %.1e%s%s\n", conv_backend_names[backend], forward, filter_forward / forward,
+	       backward, filter_backward / backward, prepare, difference(out, reference_out),
+	       difference(dw, reference_dw), difference(din, reference_din),
+	       backend != conv_backend_for(backend, &l) ? ", ran as " : "",
+	       backend != conv_backend_for(backend, &l) ? ran : "");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 16;
+    bench_layer layers[] = { { 28, 3, 32, 5 }, { 14, 32, 64, 5 }, { 14, 32, 64, 3 } };
+    for(const bench_layer &b : layers)
+	bench(b, count);
+    return(0);
+}
@@ -0,0 +1,348 @@
+#ifndef ELEMENTWISE_CPP
+#define ELEMENTWISE_CPP
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <vector>
+#include <type_traits>
+
+/*
+  elementwise math on vector<float> for neural_net.bak.cpp, as expression templates.
+  a + b, a - b, a * b (elementwise), sigmoid(a) and sigmoid_d(a) don't compute anything, they
+  return a small node that remembers its operands, so sigmoid_d(a) * (y - a) is one tree of
+  nodes and assign(out, sigmoid_d(a) * (y - a)) runs it as one loop, 8 floats at a time, straight
+  into out. nothing is allocated as long as out is already the right size.
+  an expression also converts to vector<float>, so vector<float> d = sigmoid_d(a) * (y - a) still
+  works (with one allocation instead of three). a float can stand in for either side of + - *,
+  vectors on both sides have to be the same size.
+
+  the nodes only hold pointers to the vectors they read, so don't keep one in an auto past the end
+  of the statement that made it.
+ */
+
+/*
+  float8 wraps gcc's generic vector, so the same code compiles to ymm registers inside the avx2
+  loop and to pairs of xmm ones everywhere else. everything below is always_inline: the avx2 loop
+  only gets avx2 code if the whole tree is inlined into it. a bare 32 byte vector passed to or
+  returned from a real call would go differently in avx2 and plain code, which -Wpsabi warns
+  about in every file that includes this one (and it can't be turned off for just this file, gcc
+  only reports it at the end of the translation unit). inside a struct it goes in memory either
+  way, so the struct is what crosses function boundaries and the vector math happens on .v.
+ */
+#define VEC_INLINE inline __attribute__((always_inline))
+typedef float float8v __attribute__((vector_size(32)));
+typedef int32_t int8v __attribute__((vector_size(32)));
+#define SPLAT8V(x) ((float8v){ x, x, x, x, x, x, x, x })
+
+struct float8
+{
+    float8v v;
+};
+
+VEC_INLINE float8 make8(const float8v &v)
+{
+    float8 result = { v };
+    return(result);
+}
+
+VEC_INLINE float8 splat8(float x)
+{
+    return(make8(SPLAT8V(x)));
+}
+
+VEC_INLINE float8 load8(const float *p)
+{
+    float8v v;
+    memcpy(&v, p, sizeof(v));
+    return(make8(v));
+}
+
+VEC_INLINE float8 operator+(const float8 &a, const float8 &b) { return(make8(a.v + b.v)); }
+VEC_INLINE float8 operator-(const float8 &a, const float8 &b) { return(make8(a.v - b.v)); }
+VEC_INLINE float8 operator*(const float8 &a, const float8 &b) { return(make8(a.v * b.v)); }
+VEC_INLINE float8 operator/(const float8 &a, const float8 &b) { return(make8(a.v / b.v)); }
+VEC_INLINE float8 operator-(const float8 &a) { return(make8(-a.v)); }
+VEC_INLINE float8 operator-(float a, const float8 &b) { return(make8(SPLAT8V(a) - b.v)); }
+
+/*
+  e^x the cephes way: x = n ln2 + r with |r| <= ln2 / 2, e^r from a degree 7 polynomial, and 2^n
+  put straight into the exponent bits. within 2 ulp of expf, and x is clamped to where the
+  result stays a normal float, so there's no inf or nan to worry about in sigmoid.
+ */
+#define EXP_HI 88.3762626647949f
+#define EXP_LO -87.3365447504f
+#define LOG2E 1.44269504088896341f
+#define LN2_HI 0.693359375f
+#define LN2_LO -2.12194440e-4f
+
+VEC_INLINE float8 exp8(const float8 &in)
+{
+    float8v x = in.v > SPLAT8V(EXP_HI) ? SPLAT8V(EXP_HI) : in.v;
+    x = x < SPLAT8V(EXP_LO) ? SPLAT8V(EXP_LO) : x;
+    //round to nearest by truncating and stepping down where that went up
+    float8v f = x * SPLAT8V(LOG2E) + SPLAT8V(0.5f);
+    int8v n = __builtin_convertvector(f, int8v);
+    n += (int8v)(__builtin_convertvector(n, float8v) > f);
+    float8v fn = __builtin_convertvector(n, float8v);
+    float8v r = x - fn * SPLAT8V(LN2_HI) - fn * SPLAT8V(LN2_LO);
+    float8v p = SPLAT8V(1.9875691500e-4f);
+    p = p * r + SPLAT8V(1.3981999507e-3f);
+    p = p * r + SPLAT8V(8.3334519073e-3f);
+    p = p * r + SPLAT8V(4.1665795894e-2f);
+    p = p * r + SPLAT8V(1.6666665459e-1f);
+    p = p * r + SPLAT8V(5.0000001201e-1f);
+    p = p * r * r + r + SPLAT8V(1.0f);
+    int8v scale = (n + 127) << 23;
+    return(make8(p * (float8v)scale));
+}
+
+//the same thing one float at a time, for the tails, so every element gets the same answer
+VEC_INLINE float exp1(float x)
+{
+    float8 v = exp8(splat8(x));
+    return(v.v[0]);
+}
+
+template<typename E>
+struct vec_expr
+{
+    VEC_INLINE const E &self() const { return(*static_cast<const E *>(this)); }
+    operator std::vector<float>() const;
+};
+
+//scalar is set on nodes that are a float rather than a vector, whose size() of 0 doesn't count
+struct vec_ref : vec_expr<vec_ref>
+{
+    enum { scalar = 0 };
+    const float *data;
+    size_t count;
+    vec_ref(const std::vector<float> &v) : data(v.data()), count(v.size()) {}
+    VEC_INLINE size_t size() const { return(count); }
+    VEC_INLINE float at(size_t i) const { return(data[i]); }
+    VEC_INLINE float8 at8(size_t i) const { return(load8(data + i)); }
+};
+
+struct vec_scalar : vec_expr<vec_scalar>
+{
+    enum { scalar = 1 };
+    float value;
+    vec_scalar(float value) : value(value) {}
+    VEC_INLINE size_t size() const { return(0); }
+    VEC_INLINE float at(size_t) const { return(value); }
+    VEC_INLINE float8 at8(size_t) const { return(splat8(value)); }
+};
+
+struct add_op
+{
+    template<typename T> VEC_INLINE static T apply(const T &a, const T &b) { return(a + b); }
+};
+
+struct sub_op
+{
+    template<typename T> VEC_INLINE static T apply(const T &a, const T &b) { return(a - b); }
+};
+
+struct mul_op
+{
+    template<typename T> VEC_INLINE static T apply(const T &a, const T &b) { return(a * b); }
+};
+
+struct sigmoid_op
+{
+    VEC_INLINE static float apply(float x) { return(1.0f / (1.0f + exp1(-x))); }
+    VEC_INLINE static float8 apply(const float8 &x) { return(splat8(1.0f) / (splat8(1.0f) + exp8(-x))); }
+};
+
+struct sigmoid_d_op
+{
+    template<typename T> VEC_INLINE static T apply(const T &x) { return(x * (1.0f - x)); }
+};
+
+template<typename Op, typename L, typename R>
+struct vec_binary : vec_expr<vec_binary<Op, L, R> >
+{
+    enum { scalar = L::scalar && R::scalar };
+    L l;
+    R r;
+    vec_binary(const L &l, const R &r) : l(l), r(r) { assert(L::scalar || R::scalar || l.size() == r.size()); }
+    VEC_INLINE size_t size() const { return(L::scalar ? r.size() : l.size()); }
+    VEC_INLINE float at(size_t i) const { return(Op::apply(l.at(i), r.at(i))); }
+    VEC_INLINE float8 at8(size_t i) const { return(Op::apply(l.at8(i), r.at8(i))); }
+};
+
+template<typename Op, typename A>
+struct vec_unary : vec_expr<vec_unary<Op, A> >
+{
+    enum { scalar = A::scalar };
+    A a;
+    vec_unary(const A &a) : a(a) {}
+    VEC_INLINE size_t size() const { return(a.size()); }
+    VEC_INLINE float at(size_t i) const { return(Op::apply(a.at(i))); }
+    VEC_INLINE float8 at8(size_t i) const { return(Op::apply(a.at8(i))); }
+};
+
+//what each kind of operand turns into inside a tree: vectors by pointer, floats by value, nodes as is
+template<typename T, typename Enable = void>
+struct vec_operand
+{
+    enum { vector = 0 };
+};
+
+template<>
+struct vec_operand<std::vector<float> >
+{
+    enum { vector = 1 };
+    typedef vec_ref type;
+};
+
+template<typename T>
+struct vec_operand<T, typename std::enable_if<std::is_base_of<vec_expr<T>, T>::value>::type>
+{
+    enum { vector = 1 };
+    typedef T type;
+};
+
+template<typename T>
+struct vec_operand<T, typename std::enable_if<std::is_arithmetic<T>::value>::type>
+{
+    enum { vector = 0 };
+    typedef vec_scalar type;
+};
+
+//only when one side is a vector or an expression and the other is one too or a number
+template<typename Op, typename L, typename R>
+using vec_binary_result = typename std::enable_if<
+    (vec_operand<L>::vector || vec_operand<R>::vector),
+    vec_binary<Op, typename vec_operand<L>::type, typename vec_operand<R>::type> >::type;
+
+template<typename L, typename R>
+vec_binary_result<add_op, L, R> operator+(const L &m1, const R &m2)
+{
+    /*
+      Returns the elementwise sum of two vectors.
+    */
+    return(vec_binary_result<add_op, L, R>(m1, m2));
+}
+
+template<typename L, typename R>
+vec_binary_result<sub_op, L, R> operator-(const L &m1, const R &m2)
+{
+    /*
+      Returns the difference between two vectors, m1 - m2.
+    */
+    return(vec_binary_result<sub_op, L, R>(m1, m2));
+}
+
+template<typename L, typename R>
+vec_binary_result<mul_op, L, R> operator*(const L &m1, const R &m2)
+{
+    /*
+      Returns the product of two vectors (elementwise multiplication).
+    */
+    return(vec_binary_result<mul_op, L, R>(m1, m2));
+}
+
+template<typename A>
+vec_unary<sigmoid_op, typename vec_operand<A>::type> sigmoid(const A &m1)
+{
+    /*
+      Returns the value of the sigmoid function f(x) = 1/(1 + e^-x) for every element of m1.
+    */
+    return(vec_unary<sigmoid_op, typename vec_operand<A>::type>(m1));
+}
+
+template<typename A>
+vec_unary<sigmoid_d_op, typename vec_operand<A>::type> sigmoid_d(const A &m1)
+{
+    /*
+      Returns the sigmoid derivative f'(x) = f(x)(1 - f(x)) for every element of m1, where m1
+      already holds f(x).
+    */
+    return(vec_unary<sigmoid_d_op, typename vec_operand<A>::type>(m1));
+}
+
+/*
+  the one loop every expression ends up in. the avx2 copy gets the whole tree inlined into it
+  and compiled for ymm registers, the other one for whatever the target has (sse on plain x86-64).
+ */
+template<typename E>
+void evaluate(float *out, const E &e, size_t n)
+{
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+	float8 v = e.at8(i);
+	memcpy(out + i, &v.v, sizeof(v.v));
+    }
+    for(; i < n; i++)
+	out[i] = e.at(i);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+template<typename E>
+__attribute__((target("avx2,fma")))
+void evaluate_avx2(float *out, const E &e, size_t n)
+{
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+	float8 v = e.at8(i);
+	memcpy(out + i, &v.v, sizeof(v.v));
+    }
+    for(; i < n; i++)
+	out[i] = e.at(i);
+}
+#endif
+
+inline bool elementwise_avx2()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return(avx2);
+#else
+    return(false);
+#endif
+}
+
+template<typename E>
+void evaluate_into(float *out, const E &expr, size_t n)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if(elementwise_avx2())
+    {
+	evaluate_avx2(out, expr, n);
+	return;
+    }
+#endif
+    evaluate(out, expr, n);
+}
+
+/*
+  out = e, in place when out is already the right size. out may be one of e's operands: when
+  the size changes the result goes into a new vector first, as resizing out could move the
+  floats e is still reading.
+ */
+template<typename E>
+void assign(std::vector<float> &out, const vec_expr<E> &e)
+{
+    const E &expr = e.self();
+    if(out.size() != expr.size())
+    {
+	std::vector<float> result(expr.size());
+	evaluate_into(result.data(), expr, result.size());
+	out.swap(result);
+	return;
+    }
+    evaluate_into(out.data(), expr, out.size());
+}
+
+template<typename E>
+vec_expr<E>::operator std::vector<float>() const
+{
+    std::vector<float> out;
+    assign(out, *this);
+    return(out);
+}
+#endif
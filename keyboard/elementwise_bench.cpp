@@ -0,0 +1,162 @@
+#include "elementwise.cpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <chrono>
+#include <random>
+
+//./elementwise_bench
+//./elementwise_bench size
+
+/*
+  times the elementwise math of neural_net.bak.cpp the old way (every operator returns a new
+  vector) against the expression templates writing into a vector that's already allocated, and
+  counts the allocations each one makes by replacing operator new.
+ */
+#define MIN_SECONDS 0.2
+
+using std::vector;
+
+static size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if(!p)
+	throw std::bad_alloc();
+    return(p);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+//the old versions, as they were
+vector<float> old_sigmoid_d(const vector<float> &m1)
+{
+    const uint64_t VECTOR_SIZE = m1.size();
+    vector<float> output(VECTOR_SIZE);
+
+    for(uint64_t i = 0; i < VECTOR_SIZE; i++)
+	output[i] = m1[i] * (1 - m1[i]);
+
+    return(output);
+}
+
+vector<float> old_sigmoid(const vector<float> &m1)
+{
+    const uint64_t VECTOR_SIZE = m1.size();
+    vector<float> output (VECTOR_SIZE);
+
+    for(uint64_t i = 0; i < VECTOR_SIZE; i++)
+	output[i] = 1 / (1 + exp(-m1[i]));
+
+    return(output);
+}
+
+vector<float> old_add(const vector<float> &m1, const vector<float> &m2)
+{
+    const uint64_t VECTOR_SIZE = m1.size();
+    vector<float> sum(VECTOR_SIZE);
+
+    for (uint64_t i = 0; i < VECTOR_SIZE; ++i)
+	sum[i] = m1[i] + m2[i];
+
+    return(sum);
+}
+
+vector<float> old_sub(const vector<float> &m1, const vector<float> &m2)
+{
+    const uint64_t VECTOR_SIZE = m1.size();
+    vector<float> difference(VECTOR_SIZE);
+
+    for (uint64_t i = 0; i < VECTOR_SIZE; i++)
+	difference[i] = m1[i] - m2[i];
+
+    return(difference);
+}
+
+vector<float> old_mul(const vector<float> &m1, const vector<float> &m2)
+{
+    const uint64_t VECTOR_SIZE = m1.size();
+    vector <float> product(VECTOR_SIZE);
+
+    for (uint64_t i = 0; i < VECTOR_SIZE; i++)
+	product[i] = m1[i] * m2[i];
+
+    return product;
+}
+
+template<typename F>
+double seconds_per_call(F f, size_t *allocations_per_call)
+{
+    f();
+    int calls = 0;
+    size_t before = allocations;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+    do
+    {
+	f();
+	calls++;
+	elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    while(elapsed < MIN_SECONDS);
+    *allocations_per_call = (allocations - before) / calls;
+    return(elapsed / calls);
+}
+
+float max_difference(const vector<float> &a, const vector<float> &b)
+{
+    float diff = 0.0f;
+    for(size_t i = 0; i < a.size(); i++)
+	diff = std::max(diff, fabsf(a[i] - b[i]));
+    return(diff);
+}
+
+template<typename Old, typename New>
+void bench(const char *name, size_t n, Old old_version, New new_version)
+{
+    vector<float> old_out, new_out(n);
+    size_t old_allocations, new_allocations;
+    double old_seconds = seconds_per_call([&]() { old_out = old_version(); }, &old_allocations);
+    double new_seconds = seconds_per_call([&]() { new_version(new_out); }, &new_allocations);
+    printf("%-26s old %8.3f ms %2zu allocations  fused %8.3f ms %2zu allocations  %5.1fx  max difference %g\n",
+	   name, old_seconds * 1e3, old_allocations, new_seconds * 1e3, new_allocations,
+	   old_seconds / new_seconds, max_difference(old_out, new_out));
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = argc > 1 ? atol(argv[1]) : 1 << 16;
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> dist(-4.0f, 4.0f);
+    vector<float> z(n), a(n), y(n), w(n), x(n);
+    for(size_t i = 0; i < n; i++)
+    {
+	z[i] = dist(rng);
+	a[i] = 1.0f / (1.0f + expf(-z[i]));
+	y[i] = (float)(i & 1);
+	w[i] = dist(rng);
+	x[i] = dist(rng);
+    }
+    printf("%zu floats, %s\n", n, elementwise_avx2() ? "avx2" : "no avx2");
+
+    bench("sigmoid(z)", n,
+	  [&]() { return(old_sigmoid(z)); },
+	  [&](vector<float> &out) { assign(out, sigmoid(z)); });
+    bench("sigmoid_d(a) * (y - a)", n,
+	  [&]() { return(old_mul(old_sigmoid_d(a), old_sub(y, a))); },
+	  [&](vector<float> &out) { assign(out, sigmoid_d(a) * (y - a)); });
+    bench("w + x * (y - sigmoid(z))", n,
+	  [&]() { return(old_add(w, old_mul(x, old_sub(y, old_sigmoid(z))))); },
+	  [&](vector<float> &out) { assign(out, w + x * (y - sigmoid(z))); });
+    return(0);
+}
@@ -0,0 +1,99 @@
+#define KEYBOARD_TRACKER_NO_MAIN
+#include "keyboard_tracker.cpp"
+#include <chrono>
+
+//./frequency_bench
+//./frequency_bench /mnt/c/Users/Sasha/Downloads/keyboard.png
+
+/*
+  times the frequency domain filters against the spatial laplacian that
+  laplacian_keyboard_identifier uses (3x3 gaussian then a 13 wide laplacian) on the same frame,
+  and the real (CCS) transform against a complex one on the unpadded frame like the old fft().
+ */
+#define ITERATIONS 20
+
+double time_ms(std::chrono::steady_clock::time_point start, int iterations)
+{
+    return(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations);
+}
+
+double time_filter(frequency_filter *f, const Mat &gray)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < ITERATIONS; i++)
+	filter_frequencies(f, gray);
+    return(time_ms(start, ITERATIONS));
+}
+
+void bench(const Mat &gray)
+{
+    printf("%dx%d (padded to %dx%d)\n", gray.cols, gray.rows, getOptimalDFTSize(gray.cols), getOptimalDFTSize(gray.rows));
+
+    Mat blurred, laplacian;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < ITERATIONS; i++)
+    {
+	GaussianBlur(gray, blurred, Size(3, 3), 3);
+	Laplacian(blurred, laplacian, CV_8U, 13);
+    }
+    printf("  %-28s %8.3f ms\n", "laplacian", time_ms(start, ITERATIONS));
+
+    Mat complex_in, complex_out;
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < ITERATIONS; i++)
+    {
+	gray.convertTo(complex_in, CV_32F);
+	dft(complex_in, complex_out, DFT_SCALE | DFT_COMPLEX_OUTPUT);
+	dft(complex_out, complex_in, DFT_INVERSE | DFT_REAL_OUTPUT);
+    }
+    printf("  %-28s %8.3f ms  spectrum %lu KB\n", "complex dft, unpadded", time_ms(start, ITERATIONS),
+	   complex_out.total() * complex_out.elemSize() / 1024);
+
+    frequency_filter high;
+    init_frequency_filter(&high, HIGH_PASS, 0.1f, 1.0f);
+    start = std::chrono::steady_clock::now();
+    filter_frequencies(&high, gray);
+    printf("  %-28s %8.3f ms\n", "high pass, building mask", time_ms(start, 1));
+    printf("  %-28s %8.3f ms  spectrum %lu KB\n", "high pass, cached mask", time_filter(&high, gray),
+	   high.spectrum.total() * high.spectrum.elemSize() / 1024);
+
+    frequency_filter band;
+    init_frequency_filter(&band, BAND_PASS, 0.05f, 0.5f);
+    filter_frequencies(&band, gray);
+    printf("  %-28s %8.3f ms\n", "band pass, cached mask", time_filter(&band, gray));
+
+    frequency_filter low;
+    init_frequency_filter(&low, LOW_PASS, 1.0f, 0.25f);
+    filter_frequencies(&low, gray);
+    printf("  %-28s %8.3f ms\n", "low pass, cached mask", time_filter(&low, gray));
+}
+
+int main(int argc, char** argv)
+{
+    if(argc > 1)
+    {
+	Mat gray = imread(argv[1], 0);
+	if(!gray.data)
+	    return(-1);
+	bench(gray);
+	return(0);
+    }
+
+    //something keyboard-ish: a grid of light keys with dark legends on a dark board
+    Size sizes[] = { Size(800, 300), Size(1280, 720), Size(1920, 1080) };
+    for(Size size : sizes)
+    {
+	Mat gray(size, CV_8UC1, Scalar(40));
+	int key = size.width / 16;
+	for(int y = key / 2; y + key < size.height; y += key + key / 8)
+	{
+	    for(int x = key / 2; x + key < size.width; x += key + key / 8)
+	    {
+		rectangle(gray, Rect(x, y, key, key), Scalar(200), -1);
+		rectangle(gray, Rect(x + key / 4, y + key / 4, key / 3, key / 3), Scalar(60), 2);
+	    }
+	}
+	bench(gray);
+    }
+    return(0);
+}
@@ -0,0 +1,332 @@
+#ifndef GEMM_CPP
+#define GEMM_CPP
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GEMM_X86
+#endif
+
+/*
+  single precision matrix multiply for the fully connected layers in neural_net.bak.cpp, the
+  usual goto/blis way. b is cut into KC x NC blocks and a into MC x KC blocks, each one copied
+  ("packed") into the order the micro kernel reads it: b as NR wide column panels, a as MR tall
+  row panels, both with the k index outermost and zero padded out to a whole panel. the micro
+  kernel then keeps an MR x NR tile of c in registers for the whole KC loop and only streams the
+  two panels, which are contiguous and small enough to stay in L1 (b's panel) and L2 (a's block).
+  the avx2/fma kernel or the plain one is picked at runtime.
+
+  all matrices are row major, with their rows lda, ldb and ldc floats apart.
+ */
+#define GEMM_MR 6
+#define GEMM_NR 16
+#define GEMM_MC 120
+#define GEMM_KC 256
+#define GEMM_NC 2048
+#define TRANSPOSE_BLOCK 32
+
+struct gemm_workspace
+{
+    std::vector<float> a_pack;
+    std::vector<float> b_pack;
+};
+
+/*
+  c[MR][NR] = a_panel * b_panel over kc, or c += if accumulate is set.
+  a_panel is kc columns of MR floats, b_panel is kc rows of NR floats.
+ */
+typedef void (*gemm_micro_kernel)(int kc, const float *a, const float *b, float *c, int ldc, bool accumulate);
+
+void gemm_micro_scalar(int kc, const float *a, const float *b, float *c, int ldc, bool accumulate)
+{
+    float tile[GEMM_MR][GEMM_NR] = {};
+    for(int p = 0; p < kc; p++, a += GEMM_MR, b += GEMM_NR)
+	for(int i = 0; i < GEMM_MR; i++)
+	    for(int j = 0; j < GEMM_NR; j++)
+		tile[i][j] += a[i] * b[j];
+    for(int i = 0; i < GEMM_MR; i++)
+	for(int j = 0; j < GEMM_NR; j++)
+	    c[(size_t)i * ldc + j] = accumulate ? c[(size_t)i * ldc + j] + tile[i][j] : tile[i][j];
+}
+
+#ifdef GEMM_X86
+/*
+  6 x 16 is 12 ymm accumulators plus two for the b row and one for the broadcast, which leaves
+  one of the 16 registers spare, and 12 independent fmas per k step hide the fma latency.
+ */
+__attribute__((target("avx2,fma")))
+void gemm_micro_avx2(int kc, const float *a, const float *b, float *c, int ldc, bool accumulate)
+{
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps(), c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps(), c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps(), c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+    for(int p = 0; p < kc; p++, a += GEMM_MR, b += GEMM_NR)
+    {
+	__m256 b0 = _mm256_loadu_ps(b);
+	__m256 b1 = _mm256_loadu_ps(b + 8);
+	__m256 x = _mm256_broadcast_ss(a);
+	c00 = _mm256_fmadd_ps(x, b0, c00);
+	c01 = _mm256_fmadd_ps(x, b1, c01);
+	x = _mm256_broadcast_ss(a + 1);
+	c10 = _mm256_fmadd_ps(x, b0, c10);
+	c11 = _mm256_fmadd_ps(x, b1, c11);
+	x = _mm256_broadcast_ss(a + 2);
+	c20 = _mm256_fmadd_ps(x, b0, c20);
+	c21 = _mm256_fmadd_ps(x, b1, c21);
+	x = _mm256_broadcast_ss(a + 3);
+	c30 = _mm256_fmadd_ps(x, b0, c30);
+	c31 = _mm256_fmadd_ps(x, b1, c31);
+	x = _mm256_broadcast_ss(a + 4);
+	c40 = _mm256_fmadd_ps(x, b0, c40);
+	c41 = _mm256_fmadd_ps(x, b1, c41);
+	x = _mm256_broadcast_ss(a + 5);
+	c50 = _mm256_fmadd_ps(x, b0, c50);
+	c51 = _mm256_fmadd_ps(x, b1, c51);
+    }
+#define STORE(row, lo, hi)						\
+    {									\
+	float *ci = c + (size_t)(row) * ldc;				\
+	if(accumulate)							\
+	{								\
+	    lo = _mm256_add_ps(lo, _mm256_loadu_ps(ci));		\
+	    hi = _mm256_add_ps(hi, _mm256_loadu_ps(ci + 8));		\
+	}								\
+	_mm256_storeu_ps(ci, lo);					\
+	_mm256_storeu_ps(ci + 8, hi);					\
+    }
+    STORE(0, c00, c01);
+    STORE(1, c10, c11);
+    STORE(2, c20, c21);
+    STORE(3, c30, c31);
+    STORE(4, c40, c41);
+    STORE(5, c50, c51);
+#undef STORE
+}
+#endif
+
+gemm_micro_kernel best_gemm_micro_kernel()
+{
+#ifdef GEMM_X86
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+	return(gemm_micro_avx2);
+#endif
+    return(gemm_micro_scalar);
+}
+
+//rows of a into MR tall panels, p outermost, the last panel padded with zeros
+void pack_a(int mc, int kc, const float *a, int lda, float *dst)
+{
+    //whole panels with the rows spelled out, the loop over rows costs more than the copies when n is small
+    int i0 = 0;
+    for(; i0 + GEMM_MR <= mc; i0 += GEMM_MR)
+    {
+	const float *a0 = a + (size_t)i0 * lda;
+	const float *a1 = a0 + lda;
+	const float *a2 = a1 + lda;
+	const float *a3 = a2 + lda;
+	const float *a4 = a3 + lda;
+	const float *a5 = a4 + lda;
+	for(int p = 0; p < kc; p++, dst += GEMM_MR)
+	{
+	    dst[0] = a0[p];
+	    dst[1] = a1[p];
+	    dst[2] = a2[p];
+	    dst[3] = a3[p];
+	    dst[4] = a4[p];
+	    dst[5] = a5[p];
+	}
+    }
+    for(; i0 < mc; i0 += GEMM_MR)
+    {
+	int mr = std::min(GEMM_MR, mc - i0);
+	const float *ai = a + (size_t)i0 * lda;
+	for(int p = 0; p < kc; p++, dst += GEMM_MR)
+	{
+	    int i = 0;
+	    for(; i < mr; i++)
+		dst[i] = ai[(size_t)i * lda + p];
+	    for(; i < GEMM_MR; i++)
+		dst[i] = 0.0f;
+	}
+    }
+}
+
+//columns of b into NR wide panels, p outermost, the last panel padded with zeros
+void pack_b(int kc, int nc, const float *b, int ldb, float *dst)
+{
+    for(int j0 = 0; j0 < nc; j0 += GEMM_NR)
+    {
+	int nr = std::min(GEMM_NR, nc - j0);
+	for(int p = 0; p < kc; p++, dst += GEMM_NR)
+	{
+	    const float *bp = b + (size_t)p * ldb + j0;
+	    std::copy(bp, bp + nr, dst);
+	    std::fill(dst + nr, dst + GEMM_NR, 0.0f);
+	}
+    }
+}
+
+//the packed panels start on a cache line, so no load in the micro kernel straddles two
+float *aligned_64(float *p)
+{
+    return((float *)(((uintptr_t)p + 63) & ~(uintptr_t)63));
+}
+
+//c[m][n] = a[m][k] * b[k][n], or c += a * b if accumulate is set
+void sgemm(int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c, int ldc,
+	   bool accumulate, gemm_workspace *ws, gemm_micro_kernel kernel)
+{
+    if(m <= 0 || n <= 0)
+	return;
+    if(k <= 0)
+    {
+	if(!accumulate)
+	    for(int i = 0; i < m; i++)
+		std::fill(c + (size_t)i * ldc, c + (size_t)i * ldc + n, 0.0f);
+	return;
+    }
+    ws->a_pack.resize((size_t)GEMM_MC * GEMM_KC + 16);
+    ws->b_pack.resize((size_t)GEMM_KC * ((std::min(n, GEMM_NC) + GEMM_NR - 1) / GEMM_NR * GEMM_NR) + 16);
+    float *a_pack = aligned_64(ws->a_pack.data());
+    float *b_pack = aligned_64(ws->b_pack.data());
+    float edge[GEMM_MR * GEMM_NR];
+
+    for(int jc = 0; jc < n; jc += GEMM_NC)
+    {
+	int nc = std::min(GEMM_NC, n - jc);
+	for(int pc = 0; pc < k; pc += GEMM_KC)
+	{
+	    int kc = std::min(GEMM_KC, k - pc);
+	    bool add = accumulate || pc > 0;
+	    pack_b(kc, nc, b + (size_t)pc * ldb + jc, ldb, b_pack);
+	    for(int ic = 0; ic < m; ic += GEMM_MC)
+	    {
+		int mc = std::min(GEMM_MC, m - ic);
+		pack_a(mc, kc, a + (size_t)ic * lda + pc, lda, a_pack);
+		for(int jr = 0; jr < nc; jr += GEMM_NR)
+		{
+		    int nr = std::min(GEMM_NR, nc - jr);
+		    for(int ir = 0; ir < mc; ir += GEMM_MR)
+		    {
+			int mr = std::min(GEMM_MR, mc - ir);
+			const float *a_panel = a_pack + (size_t)ir * kc;
+			const float *b_panel = b_pack + (size_t)jr * kc;
+			float *ct = c + (size_t)(ic + ir) * ldc + jc + jr;
+			if(mr == GEMM_MR && nr == GEMM_NR)
+			{
+			    kernel(kc, a_panel, b_panel, ct, ldc, add);
+			    continue;
+			}
+			//partial tile on the bottom or right edge, computed whole and copied out
+			kernel(kc, a_panel, b_panel, edge, GEMM_NR, false);
+			for(int i = 0; i < mr; i++)
+			    for(int j = 0; j < nr; j++)
+				ct[(size_t)i * ldc + j] = add ? ct[(size_t)i * ldc + j] + edge[i * GEMM_NR + j]
+				    : edge[i * GEMM_NR + j];
+		    }
+		}
+	    }
+	}
+    }
+}
+
+void sgemm(int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c, int ldc,
+	   bool accumulate = false)
+{
+    static gemm_micro_kernel kernel = best_gemm_micro_kernel();
+    thread_local gemm_workspace ws;
+    sgemm(m, n, k, a, lda, b, ldb, c, ldc, accumulate, &ws, kernel);
+}
+
+/*
+  dst[cols][rows] = src[rows][cols] transposed, TRANSPOSE_BLOCK square at a time so that both
+  the rows read and the rows written stay in cache, and with avx an 8 x 8 tile at a time in
+  registers.
+ */
+typedef void (*transpose_tile)(const float *src, int lds, float *dst, int ldd);
+
+void transpose_tile_scalar(const float *src, int lds, float *dst, int ldd)
+{
+    for(int i = 0; i < 8; i++)
+	for(int j = 0; j < 8; j++)
+	    dst[(size_t)j * ldd + i] = src[(size_t)i * lds + j];
+}
+
+#ifdef GEMM_X86
+__attribute__((target("avx")))
+void transpose_tile_avx(const float *src, int lds, float *dst, int ldd)
+{
+    __m256 r0 = _mm256_loadu_ps(src);
+    __m256 r1 = _mm256_loadu_ps(src + lds);
+    __m256 r2 = _mm256_loadu_ps(src + 2 * (size_t)lds);
+    __m256 r3 = _mm256_loadu_ps(src + 3 * (size_t)lds);
+    __m256 r4 = _mm256_loadu_ps(src + 4 * (size_t)lds);
+    __m256 r5 = _mm256_loadu_ps(src + 5 * (size_t)lds);
+    __m256 r6 = _mm256_loadu_ps(src + 6 * (size_t)lds);
+    __m256 r7 = _mm256_loadu_ps(src + 7 * (size_t)lds);
+    //pairs of rows interleaved, then pairs of pairs, then the 128 bit halves swapped across
+    __m256 t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpackhi_ps(r0, r1);
+    __m256 t2 = _mm256_unpacklo_ps(r2, r3), t3 = _mm256_unpackhi_ps(r2, r3);
+    __m256 t4 = _mm256_unpacklo_ps(r4, r5), t5 = _mm256_unpackhi_ps(r4, r5);
+    __m256 t6 = _mm256_unpacklo_ps(r6, r7), t7 = _mm256_unpackhi_ps(r6, r7);
+    r0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    r1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    r2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    r3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    r4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    r5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    r6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    r7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+    _mm256_storeu_ps(dst, _mm256_permute2f128_ps(r0, r4, 0x20));
+    _mm256_storeu_ps(dst + ldd, _mm256_permute2f128_ps(r1, r5, 0x20));
+    _mm256_storeu_ps(dst + 2 * (size_t)ldd, _mm256_permute2f128_ps(r2, r6, 0x20));
+    _mm256_storeu_ps(dst + 3 * (size_t)ldd, _mm256_permute2f128_ps(r3, r7, 0x20));
+    _mm256_storeu_ps(dst + 4 * (size_t)ldd, _mm256_permute2f128_ps(r0, r4, 0x31));
+    _mm256_storeu_ps(dst + 5 * (size_t)ldd, _mm256_permute2f128_ps(r1, r5, 0x31));
+    _mm256_storeu_ps(dst + 6 * (size_t)ldd, _mm256_permute2f128_ps(r2, r6, 0x31));
+    _mm256_storeu_ps(dst + 7 * (size_t)ldd, _mm256_permute2f128_ps(r3, r7, 0x31));
+}
+#endif
+
+transpose_tile best_transpose_tile()
+{
+#ifdef GEMM_X86
+    if(__builtin_cpu_supports("avx"))
+	return(transpose_tile_avx);
+#endif
+    return(transpose_tile_scalar);
+}
+
+void transpose_blocked(const float *src, int rows, int cols, float *dst, transpose_tile tile)
+{
+    for(int i0 = 0; i0 < rows; i0 += TRANSPOSE_BLOCK)
+    {
+	int i1 = std::min(i0 + TRANSPOSE_BLOCK, rows);
+	for(int j0 = 0; j0 < cols; j0 += TRANSPOSE_BLOCK)
+	{
+	    int j1 = std::min(j0 + TRANSPOSE_BLOCK, cols);
+	    int i = i0;
+	    for(; i + 8 <= i1; i += 8)
+	    {
+		int j = j0;
+		for(; j + 8 <= j1; j += 8)
+		    tile(src + (size_t)i * cols + j, cols, dst + (size_t)j * rows + i, rows);
+		for(; j < j1; j++)
+		    for(int ii = i; ii < i + 8; ii++)
+			dst[(size_t)j * rows + ii] = src[(size_t)ii * cols + j];
+	    }
+	    for(; i < i1; i++)
+		for(int j = j0; j < j1; j++)
+		    dst[(size_t)j * rows + i] = src[(size_t)i * cols + j];
+	}
+    }
+}
+
+void transpose_blocked(const float *src, int rows, int cols, float *dst)
+{
+    static transpose_tile tile = best_transpose_tile();
+    transpose_blocked(src, rows, cols, dst, tile);
+}
+#endif
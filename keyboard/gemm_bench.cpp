@@ -0,0 +1,165 @@
+#include "gemm.cpp"
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include <random>
+
+//./gemm_bench
+//./gemm_bench batch
+
+/*
+  times sgemm against the triple loop dot() from neural_net.bak.cpp on the fully connected
+  shapes of the key classifier (batch x 784 x 128 and batch x 128 x 62, forwards and the weight
+  gradient), plus one big square one, and transpose_blocked against the old transpose. peak is
+  a loop of independent fmas and nothing else, which is as fast as this core will go.
+ */
+#define MIN_SECONDS 0.2
+
+using std::vector;
+
+vector<float> reference_dot(const vector<float> &m1, const vector<float> &m2, const int m1_rows, const int m1_columns, const int m2_columns)
+{
+    vector <float> output (m1_rows*m2_columns);
+
+    for(int row = 0; row < m1_rows; row++)
+    {
+	for(int col = 0; col < m2_columns; col++)
+	{
+	    output[row * m2_columns + col] = 0.0f;
+	    for(int k = 0; k < m1_columns; k++)
+		output[ row * m2_columns + col ] += m1[ row * m1_columns + k ] * m2[ k * m2_columns + col ];
+	}
+    }
+
+    return output;
+}
+
+vector<float> reference_transpose(float *m, const int C, const int R)
+{
+    vector<float> mT(C*R);
+
+    for(uint64_t n = 0; n < (uint64_t)C*R; n++)
+    {
+	uint64_t i = n/C;
+	uint64_t j = n%C;
+	mT[n] = m[R*j + i];
+    }
+
+    return mT;
+}
+
+//runs f until MIN_SECONDS have gone by and returns the seconds per call
+template<typename F>
+double seconds_per_call(F f)
+{
+    f();
+    int calls = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+    do
+    {
+	f();
+	calls++;
+	elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    while(elapsed < MIN_SECONDS);
+    return(elapsed / calls);
+}
+
+#ifdef GEMM_X86
+__attribute__((target("avx2,fma")))
+float fma_loop(long iterations)
+{
+    __m256 x = _mm256_set1_ps(0.999f), y = _mm256_set1_ps(0.001f);
+    __m256 c0 = x, c1 = x, c2 = x, c3 = x, c4 = x, c5 = x, c6 = x, c7 = x, c8 = x, c9 = x;
+    for(long i = 0; i < iterations; i++)
+    {
+	c0 = _mm256_fmadd_ps(c0, x, y); c1 = _mm256_fmadd_ps(c1, x, y);
+	c2 = _mm256_fmadd_ps(c2, x, y); c3 = _mm256_fmadd_ps(c3, x, y);
+	c4 = _mm256_fmadd_ps(c4, x, y); c5 = _mm256_fmadd_ps(c5, x, y);
+	c6 = _mm256_fmadd_ps(c6, x, y); c7 = _mm256_fmadd_ps(c7, x, y);
+	c8 = _mm256_fmadd_ps(c8, x, y); c9 = _mm256_fmadd_ps(c9, x, y);
+    }
+    __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(c0, c1), _mm256_add_ps(c2, c3)),
+			       _mm256_add_ps(_mm256_add_ps(c4, c5), _mm256_add_ps(c6, c7)));
+    sum = _mm256_add_ps(sum, _mm256_add_ps(c8, c9));
+    float out[8];
+    _mm256_storeu_ps(out, sum);
+    return(out[0]);
+}
+#endif
+
+double peak_gflops()
+{
+#ifdef GEMM_X86
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+	//volatile so the call can't be hoisted out of the timing loop
+	volatile long iterations = 10000000;
+	volatile float sink = 0.0f;
+	double seconds = seconds_per_call([&]() { sink = sink + fma_loop(iterations); });
+	return(iterations * 10.0 * 16.0 / seconds * 1e-9);
+    }
+#endif
+    return(0.0);
+}
+
+void bench_gemm(const char *name, int m, int k, int n, double peak, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    vector<float> a((size_t)m * k), b((size_t)k * n), c((size_t)m * n);
+    for(float &v : a)
+	v = dist(rng);
+    for(float &v : b)
+	v = dist(rng);
+
+    vector<float> reference;
+    double naive = seconds_per_call([&]() { reference = reference_dot(a, b, m, k, n); });
+    gemm_workspace ws;
+    double scalar = seconds_per_call([&]() {
+	    sgemm(m, n, k, a.data(), k, b.data(), n, c.data(), n, false, &ws, gemm_micro_scalar); });
+    double best = seconds_per_call([&]() { sgemm(m, n, k, a.data(), k, b.data(), n, c.data(), n); });
+
+    float diff = 0.0f;
+    for(size_t i = 0; i < c.size(); i++)
+	diff = std::max(diff, fabsf(reference[i] - c[i]) / (1.0f + fabsf(reference[i])));
+    double flops = 2.0 * m * n * k * 1e-9;
+    printf("%-14s %4d x %4d x %4d  dot %8.3f ms %5.1f GFLOP/s  packed scalar %8.3f ms  sgemm %8.3f ms %5.1f GFLOP/s",
+	   name, m, k, n, naive * 1e3, flops / naive, scalar * 1e3, best * 1e3, flops / best);
+    if(peak > 0.0)
+	printf(" (%2.0f%% of peak)", 100.0 * flops / best / peak);
+    printf("  %5.1fx  max difference %g\n", naive / best, diff);
+}
+
+void bench_transpose(int rows, int cols)
+{
+    vector<float> m((size_t)rows * cols), t((size_t)rows * cols);
+    for(size_t i = 0; i < m.size(); i++)
+	m[i] = (float)i;
+    vector<float> reference;
+    //the old transpose takes the input as C rows of R columns
+    double naive = seconds_per_call([&]() { reference = reference_transpose(m.data(), rows, cols); });
+    double blocked = seconds_per_call([&]() { transpose_blocked(m.data(), rows, cols, t.data()); });
+    printf("transpose      %4d x %4d  old %8.3f ms  blocked %8.3f ms  %5.1fx  %s\n", rows, cols,
+	   naive * 1e3, blocked * 1e3, naive / blocked, reference == t ? "same" : "DIFFERENT");
+}
+
+int main(int argc, char** argv)
+{
+    int batch = argc > 1 ? atoi(argv[1]) : 64;
+    std::mt19937 rng(1234);
+    double peak = peak_gflops();
+    if(peak > 0.0)
+	printf("fma peak %.1f GFLOP/s\n", peak);
+
+    bench_gemm("fc1 forward", batch, 784, 128, peak, rng);
+    bench_gemm("fc2 forward", batch, 128, 62, peak, rng);
+    bench_gemm("fc1 gradient", 784, batch, 128, peak, rng);
+    bench_gemm("fc2 gradient", 128, batch, 62, peak, rng);
+    bench_gemm("square", 512, 512, 512, peak, rng);
+
+    bench_transpose(batch, 784);
+    bench_transpose(784, 128);
+    bench_transpose(1024, 1024);
+    return(0);
+}
@@ -0,0 +1,95 @@
+#define KEYBOARD_TRACKER_NO_MAIN
+#include "keyboard_tracker.cpp"
+#include <chrono>
+
+//./join_bench
+
+/*
+  times join_overlapping_rectangles against the old pairwise version on random rectangles,
+  100 to 10000 of them spread so there's roughly the same density of overlaps at every size.
+  the pairwise version grows a rectangle in place and never looks back, so it can leave boxes
+  that overlap; reference_join repeats it until nothing changes, which is the right answer, and
+  the new version has to match it exactly (as a set).
+ */
+void pairwise_join(vector<Rect> &rects)
+{
+    for(int i = 0; i + 1 < (int)rects.size(); i++)
+    {
+	for(int j = i + 1; j < (int)rects.size(); j++)
+	{
+	    Rect intersection = rects[i] & rects[j];
+	    Rect minimum_enclosing = rects[i] | rects[j];
+	    if(intersection.area() > 0)
+	    {
+		rects[i] = minimum_enclosing;
+		rects.erase(rects.begin() + j--);
+	    }
+	}
+    }
+}
+
+void reference_join(vector<Rect> &rects)
+{
+    size_t before;
+    do
+    {
+	before = rects.size();
+	pairwise_join(rects);
+    } while(rects.size() != before);
+}
+
+vector<Rect> random_rects(int n, RNG &rng)
+{
+    int side = (int)(60 * sqrt((double)n));
+    vector<Rect> rects(n);
+    for(Rect &r : rects)
+    {
+	r.width = rng.uniform(5, 30);
+	r.height = rng.uniform(5, 30);
+	r.x = rng.uniform(0, side);
+	r.y = rng.uniform(0, side);
+    }
+    return(rects);
+}
+
+bool rect_less(const Rect &a, const Rect &b)
+{
+    if(a.x != b.x) return(a.x < b.x);
+    if(a.y != b.y) return(a.y < b.y);
+    if(a.width != b.width) return(a.width < b.width);
+    return(a.height < b.height);
+}
+
+double time_join(void (*join)(vector<Rect> &), const vector<Rect> &input, vector<Rect> &output, int iterations)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < iterations; i++)
+    {
+	output = input;
+	join(output);
+    }
+    return(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations);
+}
+
+int main(int argc, char** argv)
+{
+    RNG rng(1234);
+    int sizes[] = { 100, 300, 1000, 3000, 10000 };
+    printf("%6s %12s %12s %8s %10s %10s %10s\n", "rects", "pairwise ms", "sweep ms", "speedup", "pairwise", "sweep", "reference");
+    for(int n : sizes)
+    {
+	vector<Rect> input = random_rects(n, rng);
+	int iterations = n <= 1000 ? 20 : 3;
+	vector<Rect> pairwise, sweep, reference;
+	double pairwise_ms = time_join(pairwise_join, input, pairwise, iterations);
+	double sweep_ms = time_join(join_overlapping_rectangles, input, sweep, iterations);
+	reference = input;
+	reference_join(reference);
+
+	std::sort(sweep.begin(), sweep.end(), rect_less);
+	std::sort(reference.begin(), reference.end(), rect_less);
+	printf("%6d %12.3f %12.3f %7.1fx %10lu %10lu %10lu%s\n", n, pairwise_ms, sweep_ms, pairwise_ms / sweep_ms,
+	       pairwise.size(), sweep.size(), reference.size(), sweep == reference ? "" : "  MISMATCH");
+    }
+    return(0);
+}
@@ -0,0 +1,422 @@
+#ifndef KEY_CLASSIFIER_CPP
+#define KEY_CLASSIFIER_CPP
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "gemm.cpp"
+
+/*
+  a small cnn inference engine for the key classifier, so the robot doesn't need tensorflow.
+  it knows 5x5 (or any odd size) 'same' convolutions, relu, max pooling, fully connected layers
+  and softmax, which is everything cnn_model was heading towards.
+  activations are kept NHWC in floats, a whole batch at a time, layer by layer, and nearly all
+  the time goes into sgemm (gemm.cpp), with the bias copied into the output first and the
+  products added onto it.
+  a fully connected layer is one matrix multiply over the whole batch. a convolution works on a
+  zero padded copy of the image, where for one output row and one kernel row the k x c inputs
+  under pixel x start c floats after the ones under pixel x - 1. so the image already is the
+  im2col matrix for that kernel row, with rows that overlap (lda = c), and the convolution is
+  k matrix multiplies that accumulate, one per kernel row, without ever building im2col. each
+  covers every output row at once by running on across the padding, so it makes k - 1 pixels
+  too many per row that get dropped.
+
+  weights file, little endian int32 and float32:
+    "KCNN" version(1) input_size input_channels layer_count
+    then per layer its type and
+      LAYER_CONV:    in_channels out_channels kernel weights[out][kernel][kernel][in] bias[out]
+      LAYER_RELU:    -
+      LAYER_MAXPOOL: size (the stride is the same)
+      LAYER_DENSE:   in out weights[out][in] bias[out], the input is flattened h, w, c
+      LAYER_SOFTMAX: -
+  the weights are transposed to [in][out] on load, which is what sgemm wants.
+ */
+enum { LAYER_CONV = 1, LAYER_RELU, LAYER_MAXPOOL, LAYER_DENSE, LAYER_SOFTMAX };
+#define KEY_CLASSIFIER_VERSION 1
+#define KEY_CLASSIFIER_MAX_LAYERS 256
+
+struct cnn_layer
+{
+    int type;
+    int in_channels;
+    int out_channels;
+    int kernel;
+    int pool;
+    std::vector<float> weights;
+    std::vector<float> bias;
+};
+
+struct key_classifier
+{
+    int input_size;
+    int input_channels;
+    std::vector<cnn_layer> layers;
+};
+
+//ping-pong activations, the padded image and the batch's features, one per thread that classifies
+struct cnn_workspace
+{
+    std::vector<float> in;
+    std::vector<float> out;
+    std::vector<float> padded;
+    std::vector<float> wide;
+    std::vector<float> features;
+    std::vector<float> probabilities;
+    gemm_workspace gemm;
+};
+
+//c[m][n] = bias[n], for sgemm to accumulate the products onto
+void fill_bias(float *c, const float *bias, int m, int n)
+{
+    for(int i = 0; i < m; i++)
+	std::copy(bias, bias + n, c + (size_t)i * n);
+}
+
+//copies an image into the middle of a zero image pad pixels bigger on every side
+void pad_image(const float *image, int size, int channels, int pad, float *padded)
+{
+    int padded_size = size + 2 * pad;
+    std::fill(padded, padded + (size_t)padded_size * padded_size * channels, 0.0f);
+    for(int y = 0; y < size; y++)
+	memcpy(padded + ((size_t)(y + pad) * padded_size + pad) * channels, image + (size_t)y * size * channels,
+	       (size_t)size * channels * sizeof(float));
+}
+
+/*
+  'same' convolution of one image, weights are [ky][kx][in][out]. for kernel row ky the matrix
+  under output pixel (y, x) is row y * padded_size + x of the padded image from row ky on, read
+  with lda = channels, so one multiply does all the output rows padded_size wide into wide and
+  the size pixels of each row are copied out.
+ */
+void convolve(const float *padded, int size, int channels, const cnn_layer *l, float *out, std::vector<float> &wide,
+	      gemm_workspace *ws, gemm_micro_kernel micro)
+{
+    int padded_size = size + l->kernel - 1;
+    int row_k = l->kernel * channels;
+    int m = (size - 1) * padded_size + size;
+    wide.resize((size_t)m * l->out_channels);
+    fill_bias(wide.data(), l->bias.data(), m, l->out_channels);
+    for(int ky = 0; ky < l->kernel; ky++)
+	sgemm(m, l->out_channels, row_k, padded + (size_t)ky * padded_size * channels, channels,
+	      l->weights.data() + (size_t)ky * row_k * l->out_channels, l->out_channels, wide.data(), l->out_channels,
+	      true, ws, micro);
+    for(int y = 0; y < size; y++)
+	memcpy(out + (size_t)y * size * l->out_channels, wide.data() + (size_t)y * padded_size * l->out_channels,
+	       (size_t)size * l->out_channels * sizeof(float));
+}
+
+void max_pool(const float *image, int size, int channels, int pool, float *out)
+{
+    int out_size = size / pool;
+    for(int y = 0; y < out_size; y++)
+    {
+	for(int x = 0; x < out_size; x++)
+	{
+	    float *o = out + ((size_t)y * out_size + x) * channels;
+	    std::fill(o, o + channels, -INFINITY);
+	    for(int py = 0; py < pool; py++)
+	    {
+		for(int px = 0; px < pool; px++)
+		{
+		    const float *p = image + ((size_t)(y * pool + py) * size + x * pool + px) * channels;
+		    for(int c = 0; c < channels; c++)
+			o[c] = std::max(o[c], p[c]);
+		}
+	    }
+	}
+    }
+}
+
+void softmax(float *v, int n)
+{
+    float top = *std::max_element(v, v + n);
+    float sum = 0.0f;
+    for(int i = 0; i < n; i++)
+    {
+	v[i] = expf(v[i] - top);
+	sum += v[i];
+    }
+    for(int i = 0; i < n; i++)
+	v[i] /= sum;
+}
+
+bool read_ints(FILE *f, int *values, int count)
+{
+    return(fread(values, sizeof(int), count, f) == (size_t)count);
+}
+
+//won't size the vector past what's left in the file, so a bad count fails instead of throwing
+bool read_floats(FILE *f, std::vector<float> &values, size_t count)
+{
+    long at = ftell(f);
+    if(at < 0 || fseek(f, 0, SEEK_END) != 0)
+	return(false);
+    long end = ftell(f);
+    if(fseek(f, at, SEEK_SET) != 0 || end < at || count > (size_t)(end - at) / sizeof(float))
+	return(false);
+    values.resize(count);
+    return(fread(values.data(), sizeof(float), count, f) == count);
+}
+
+//rows x cols to cols x rows
+void transpose_weights(std::vector<float> &w, int rows, int cols)
+{
+    std::vector<float> t(w.size());
+    for(int r = 0; r < rows; r++)
+	for(int c = 0; c < cols; c++)
+	    t[(size_t)c * rows + r] = w[(size_t)r * cols + c];
+    w.swap(t);
+}
+
+bool load_key_classifier(const char *path, key_classifier *model)
+{
+    FILE *f = fopen(path, "rb");
+    if(!f)
+    {
+	fprintf(stderr, "couldn't open %s\n", path);
+	return(false);
+    }
+    char magic[4];
+    int header[4] = { 0, 0, 0, 0 };
+    bool ok = fread(magic, 1, 4, f) == 4 && memcmp(magic, "KCNN", 4) == 0 && read_ints(f, header, 4) &&
+	header[0] == KEY_CLASSIFIER_VERSION && header[1] > 0 && header[2] > 0 && header[3] > 0 &&
+	header[3] <= KEY_CLASSIFIER_MAX_LAYERS;
+    model->input_size = ok ? header[1] : 0;
+    model->input_channels = ok ? header[2] : 0;
+    model->layers.assign(ok ? header[3] : 0, cnn_layer());
+
+    //track the shape through the layers so a file that doesn't add up is caught here and not mid frame
+    int size = model->input_size;
+    int channels = model->input_channels;
+    for(int i = 0; ok && i < (int)model->layers.size(); i++)
+    {
+	cnn_layer &l = model->layers[i];
+	ok = read_ints(f, &l.type, 1);
+	int shape[3];
+	switch(ok ? l.type : 0)
+	{
+	case LAYER_CONV:
+	    ok = read_ints(f, shape, 3) && shape[0] == channels && shape[1] > 0 && shape[2] > 0 && shape[2] % 2 == 1;
+	    l.in_channels = shape[0];
+	    l.out_channels = shape[1];
+	    l.kernel = shape[2];
+	    ok = ok && read_floats(f, l.weights, (size_t)l.out_channels * l.kernel * l.kernel * l.in_channels) &&
+		read_floats(f, l.bias, l.out_channels);
+	    if(ok)
+		transpose_weights(l.weights, l.out_channels, l.kernel * l.kernel * l.in_channels);
+	    channels = l.out_channels;
+	    break;
+	case LAYER_MAXPOOL:
+	    ok = read_ints(f, &l.pool, 1) && l.pool > 0 && l.pool <= size;
+	    size /= std::max(l.pool, 1);
+	    break;
+	case LAYER_DENSE:
+	    ok = read_ints(f, shape, 2) && (int64_t)shape[0] == (int64_t)size * size * channels && shape[1] > 0;
+	    l.in_channels = shape[0];
+	    l.out_channels = shape[1];
+	    ok = ok && read_floats(f, l.weights, (size_t)l.out_channels * l.in_channels) &&
+		read_floats(f, l.bias, l.out_channels);
+	    if(ok)
+		transpose_weights(l.weights, l.out_channels, l.in_channels);
+	    size = 1;
+	    channels = l.out_channels;
+	    break;
+	case LAYER_RELU:
+	case LAYER_SOFTMAX:
+	    break;
+	default:
+	    ok = false;
+	}
+    }
+    fclose(f);
+    if(!ok)
+	fprintf(stderr, "%s isn't a key classifier this version can read\n", path);
+    return(ok);
+}
+
+//writes a model in the format load_key_classifier reads, with the weights back in file order
+bool save_key_classifier(const char *path, const key_classifier *model)
+{
+    FILE *f = fopen(path, "wb");
+    if(!f)
+    {
+	fprintf(stderr, "couldn't write %s\n", path);
+	return(false);
+    }
+    int header[4] = { KEY_CLASSIFIER_VERSION, model->input_size, model->input_channels, (int)model->layers.size() };
+    fwrite("KCNN", 1, 4, f);
+    fwrite(header, sizeof(int), 4, f);
+    for(const cnn_layer &l : model->layers)
+    {
+	fwrite(&l.type, sizeof(int), 1, f);
+	std::vector<float> weights = l.weights;
+	switch(l.type)
+	{
+	case LAYER_CONV:
+	{
+	    int shape[3] = { l.in_channels, l.out_channels, l.kernel };
+	    fwrite(shape, sizeof(int), 3, f);
+	    transpose_weights(weights, l.kernel * l.kernel * l.in_channels, l.out_channels);
+	    fwrite(weights.data(), sizeof(float), weights.size(), f);
+	    fwrite(l.bias.data(), sizeof(float), l.bias.size(), f);
+	    break;
+	}
+	case LAYER_MAXPOOL:
+	    fwrite(&l.pool, sizeof(int), 1, f);
+	    break;
+	case LAYER_DENSE:
+	{
+	    int shape[2] = { l.in_channels, l.out_channels };
+	    fwrite(shape, sizeof(int), 2, f);
+	    transpose_weights(weights, l.in_channels, l.out_channels);
+	    fwrite(weights.data(), sizeof(float), weights.size(), f);
+	    fwrite(l.bias.data(), sizeof(float), l.bias.size(), f);
+	    break;
+	}
+	}
+    }
+    bool ok = !ferror(f);
+    ok = fclose(f) == 0 && ok;
+    if(!ok)
+	fprintf(stderr, "couldn't finish writing %s\n", path);
+    return(ok);
+}
+
+//the number of outputs per crop, i.e. classes
+int classifier_outputs(const key_classifier *model)
+{
+    int size = model->input_size;
+    int channels = model->input_channels;
+    for(const cnn_layer &l : model->layers)
+    {
+	if(l.type == LAYER_CONV || l.type == LAYER_DENSE)
+	    channels = l.out_channels;
+	if(l.type == LAYER_MAXPOOL)
+	    size /= l.pool;
+	if(l.type == LAYER_DENSE)
+	    size = 1;
+    }
+    return(size * size * channels);
+}
+
+//runs layers [begin, end) on the count images in ws->in, size and channels follow the shape along
+void run_layers(const key_classifier *model, int begin, int end, int count, int *size, int *channels,
+		cnn_workspace *ws, gemm_micro_kernel micro)
+{
+    for(int i = begin; i < end; i++)
+    {
+	const cnn_layer &l = model->layers[i];
+	size_t per_image = (size_t)*size * *size * *channels;
+	switch(l.type)
+	{
+	case LAYER_CONV:
+	{
+	    int pad = l.kernel / 2;
+	    size_t out_image = (size_t)*size * *size * l.out_channels;
+	    ws->padded.resize((size_t)(*size + 2 * pad) * (*size + 2 * pad) * *channels);
+	    ws->out.resize(out_image * count);
+	    for(int n = 0; n < count; n++)
+	    {
+		pad_image(ws->in.data() + n * per_image, *size, *channels, pad, ws->padded.data());
+		convolve(ws->padded.data(), *size, *channels, &l, ws->out.data() + n * out_image, ws->wide, &ws->gemm,
+			 micro);
+	    }
+	    *channels = l.out_channels;
+	    ws->in.swap(ws->out);
+	    break;
+	}
+	case LAYER_RELU:
+	    for(size_t j = 0; j < per_image * count; j++)
+		ws->in[j] = std::max(ws->in[j], 0.0f);
+	    break;
+	case LAYER_MAXPOOL:
+	{
+	    int out_size = *size / l.pool;
+	    size_t out_image = (size_t)out_size * out_size * *channels;
+	    ws->out.resize(out_image * count);
+	    for(int n = 0; n < count; n++)
+		max_pool(ws->in.data() + n * per_image, *size, *channels, l.pool, ws->out.data() + n * out_image);
+	    *size = out_size;
+	    ws->in.swap(ws->out);
+	    break;
+	}
+	case LAYER_DENSE:
+	    ws->out.resize((size_t)l.out_channels * count);
+	    fill_bias(ws->out.data(), l.bias.data(), count, l.out_channels);
+	    sgemm(count, l.out_channels, l.in_channels, ws->in.data(), l.in_channels, l.weights.data(), l.out_channels,
+		  ws->out.data(), l.out_channels, true, &ws->gemm, micro);
+	    *size = 1;
+	    *channels = l.out_channels;
+	    ws->in.swap(ws->out);
+	    break;
+	case LAYER_SOFTMAX:
+	    for(int n = 0; n < count; n++)
+		softmax(ws->in.data() + n * per_image, per_image);
+	    break;
+	}
+    }
+}
+
+/*
+  runs count crops (input_size x input_size x input_channels bytes each, back to back like a
+  key_batch) through the network, probabilities come out as count x classes.
+  the layers before the first fully connected one go an image at a time so its activations stay
+  in cache (a whole batch of 28x28x32 floats doesn't fit), the rest take the whole batch at once
+  so each weight matrix is only read once.
+ */
+void run_key_classifier(const key_classifier *model, const uint8_t *crops, int count, cnn_workspace *ws,
+			std::vector<float> &probabilities, gemm_micro_kernel micro)
+{
+    int first_dense = 0;
+    while(first_dense < (int)model->layers.size() && model->layers[first_dense].type != LAYER_DENSE)
+	first_dense++;
+
+    size_t per_crop = (size_t)model->input_size * model->input_size * model->input_channels;
+    size_t features = 0;
+    int size = 0;
+    int channels = 0;
+    for(int n = 0; n < count; n++)
+    {
+	size = model->input_size;
+	channels = model->input_channels;
+	ws->in.resize(per_crop);
+	for(size_t i = 0; i < per_crop; i++)
+	    ws->in[i] = crops[n * per_crop + i] * (1.0f / 255.0f);
+	run_layers(model, 0, first_dense, 1, &size, &channels, ws, micro);
+
+	features = (size_t)size * size * channels;
+	ws->features.resize(features * count);
+	std::copy(ws->in.begin(), ws->in.begin() + features, ws->features.begin() + n * features);
+    }
+    ws->in.swap(ws->features);
+    run_layers(model, first_dense, model->layers.size(), count, &size, &channels, ws, micro);
+    probabilities.assign(ws->in.begin(), ws->in.begin() + (size_t)size * size * channels * count);
+}
+
+void run_key_classifier(const key_classifier *model, const uint8_t *crops, int count, cnn_workspace *ws,
+			std::vector<float> &probabilities)
+{
+    static gemm_micro_kernel micro = best_gemm_micro_kernel();
+    run_key_classifier(model, crops, count, ws, probabilities, micro);
+}
+
+//the most likely class of every crop and how sure the network is of it
+void classify_keys(const key_classifier *model, const uint8_t *crops, int count, cnn_workspace *ws,
+		   std::vector<int> &labels, std::vector<float> &confidence)
+{
+    std::vector<float> &probabilities = ws->probabilities;
+    run_key_classifier(model, crops, count, ws, probabilities);
+    int classes = classifier_outputs(model);
+    labels.resize(count);
+    confidence.resize(count);
+    for(int n = 0; n < count; n++)
+    {
+	const float *p = probabilities.data() + (size_t)n * classes;
+	int best = std::max_element(p, p + classes) - p;
+	labels[n] = best;
+	confidence[n] = p[best];
+    }
+}
+#endif
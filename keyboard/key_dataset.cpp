@@ -0,0 +1,261 @@
+#ifndef KEY_DATASET_CPP
+#define KEY_DATASET_CPP
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+/*
+  the training set as one file that's mmapped instead of parsed, so opening it costs the same
+  no matter how many images there are, and the images are already decoded and resized.
+
+  little endian:
+    key_dataset_header
+    int32 labels[count]              0 based classes (the yaml's are 1 based)
+    int32 train[train_count]         0 based image indices, same for test and validation
+    int32 test[test_count]
+    int32 validation[validation_count]
+    padding up to a page
+    uint8 images[count][size][size][channels], bgr, NHWC like key_batch
+
+  the images start on a page boundary, so each one is a plain CV_8UC3 Mat over the mapping.
+  the mapping is read only: the Mats dataset_image hands out must not be written to.
+ */
+#define KEY_DATASET_MAGIC "KDAT"
+#define KEY_DATASET_VERSION 1
+#define KEY_DATASET_ALIGN 4096
+//bounds that keep size * size * channels well inside 64 bits, channels is CV_CN_MAX
+#define KEY_DATASET_MAX_SIZE 65536
+#define KEY_DATASET_MAX_CHANNELS 512
+
+struct key_dataset_header
+{
+    char magic[4];
+    int32_t version;
+    int32_t count;
+    int32_t image_size;
+    int32_t channels;
+    int32_t train_count;
+    int32_t test_count;
+    int32_t validation_count;
+    uint64_t images_offset;
+};
+
+struct key_dataset
+{
+    int fd;
+    size_t length;
+    const uint8_t *base;
+    const key_dataset_header *header;
+    const int32_t *labels;
+    const int32_t *train;
+    const int32_t *test;
+    const int32_t *validation;
+    const uint8_t *images;
+};
+
+size_t key_dataset_image_bytes(const key_dataset_header *header)
+{
+    return((size_t)header->image_size * header->image_size * header->channels);
+}
+
+uint64_t key_dataset_images_offset(const key_dataset_header *header)
+{
+    uint64_t end = sizeof(key_dataset_header) + sizeof(int32_t) *
+	((uint64_t)header->count + header->train_count + header->test_count + header->validation_count);
+    return((end + KEY_DATASET_ALIGN - 1) / KEY_DATASET_ALIGN * KEY_DATASET_ALIGN);
+}
+
+//every value in [low, high)
+bool all_in_range(const int32_t *values, int count, int32_t low, int32_t high)
+{
+    for(int i = 0; i < count; i++)
+	if(values[i] < low || values[i] >= high)
+	    return(false);
+    return(true);
+}
+
+void close_key_dataset(key_dataset *ds)
+{
+    if(ds->base)
+	munmap((void *)ds->base, ds->length);
+    if(ds->fd >= 0)
+	close(ds->fd);
+    memset(ds, 0, sizeof(*ds));
+    ds->fd = -1;
+}
+
+bool open_key_dataset(const char *path, key_dataset *ds)
+{
+    memset(ds, 0, sizeof(*ds));
+    ds->fd = open(path, O_RDONLY);
+    if(ds->fd < 0)
+    {
+	fprintf(stderr, "couldn't open %s\n", path);
+	return(false);
+    }
+    struct stat st;
+    if(fstat(ds->fd, &st) != 0 || (size_t)st.st_size < sizeof(key_dataset_header))
+    {
+	fprintf(stderr, "%s is too short to be a dataset\n", path);
+	close_key_dataset(ds);
+	return(false);
+    }
+    ds->length = st.st_size;
+    void *base = mmap(nullptr, ds->length, PROT_READ, MAP_PRIVATE, ds->fd, 0);
+    if(base == MAP_FAILED)
+    {
+	fprintf(stderr, "couldn't map %s\n", path);
+	ds->length = 0;
+	close_key_dataset(ds);
+	return(false);
+    }
+    ds->base = (const uint8_t *)base;
+
+    const key_dataset_header *h = (const key_dataset_header *)ds->base;
+    bool valid = memcmp(h->magic, KEY_DATASET_MAGIC, 4) == 0 && h->version == KEY_DATASET_VERSION &&
+	h->count >= 0 && h->image_size > 0 && h->image_size <= KEY_DATASET_MAX_SIZE && h->channels > 0 &&
+	h->channels <= KEY_DATASET_MAX_CHANNELS && h->train_count >= 0 && h->test_count >= 0 &&
+	h->validation_count >= 0 && h->images_offset == key_dataset_images_offset(h) &&
+	h->images_offset <= ds->length &&
+	(uint64_t)h->count <= (ds->length - h->images_offset) / key_dataset_image_bytes(h);
+    if(valid)
+    {
+	ds->labels = (const int32_t *)(h + 1);
+	ds->train = ds->labels + h->count;
+	ds->test = ds->train + h->train_count;
+	ds->validation = ds->test + h->test_count;
+	//a label is a class, so it only has to be >= 0, indices have to name an image
+	valid = all_in_range(ds->labels, h->count, 0, INT32_MAX) &&
+	    all_in_range(ds->train, h->train_count, 0, h->count) &&
+	    all_in_range(ds->test, h->test_count, 0, h->count) &&
+	    all_in_range(ds->validation, h->validation_count, 0, h->count);
+    }
+    if(!valid)
+    {
+	fprintf(stderr, "%s isn't a version %d dataset\n", path, KEY_DATASET_VERSION);
+	close_key_dataset(ds);
+	return(false);
+    }
+    ds->header = h;
+    ds->images = ds->base + h->images_offset;
+    return(true);
+}
+
+const uint8_t *dataset_pixels(const key_dataset *ds, int i)
+{
+    return(ds->images + (size_t)i * key_dataset_image_bytes(ds->header));
+}
+
+//image i as a Mat over the mapping, nothing is copied
+Mat dataset_image(const key_dataset *ds, int i)
+{
+    int size = ds->header->image_size;
+    return(Mat(size, size, CV_8UC(ds->header->channels), (void *)dataset_pixels(ds, i)));
+}
+
+/*
+  the matlab index lists are 1 based and may be a matrix of several splits padded with zeros,
+  the first split (row, after matlab2opencv's transpose) is the one that's kept.
+ */
+vector<int32_t> dataset_indices(const Mat &m, int count)
+{
+    vector<int32_t> indices;
+    if(m.empty())
+	return(indices);
+    Mat values;
+    m.convertTo(values, CV_32S);
+    if(values.rows > 1 && values.cols > 1)
+	values = values.row(0);
+    values = values.reshape(1, 1);
+    for(int i = 0; i < values.cols; i++)
+    {
+	int index = values.at<int32_t>(i) - 1;
+	if(index >= 0 && index < count)
+	    indices.push_back(index);
+    }
+    return(indices);
+}
+
+/*
+  reads the yaml (and every image it names) the way read_data always has, and writes it all out
+  as one dataset with each image resized to size x size. the file is written next to the real
+  one and renamed over it at the end, so a failed run never leaves half a dataset behind.
+ */
+bool write_key_dataset(const string &yml, const string &path, int size)
+{
+    auto data_pair = read_data(yml);
+    auto &data = data_pair.first;
+    const vector<string> &filenames = data_pair.second;
+
+    key_dataset_header header;
+    memcpy(header.magic, KEY_DATASET_MAGIC, 4);
+    header.version = KEY_DATASET_VERSION;
+    header.count = filenames.size();
+    header.image_size = size;
+    header.channels = 3;
+
+    Mat label_values;
+    data["ALLlabels"].convertTo(label_values, CV_32S);
+    label_values = label_values.reshape(1, 1);
+    if(label_values.cols != header.count)
+    {
+	fprintf(stderr, "%s has %d labels for %d images\n", yml.c_str(), label_values.cols, header.count);
+	return(false);
+    }
+    vector<int32_t> labels(header.count);
+    for(int i = 0; i < header.count; i++)
+	labels[i] = label_values.at<int32_t>(i) - 1;
+    vector<int32_t> train = dataset_indices(data["TRNind"], header.count);
+    vector<int32_t> test = dataset_indices(data["TSTind"], header.count);
+    vector<int32_t> validation = dataset_indices(data["VALind"], header.count);
+    header.train_count = train.size();
+    header.test_count = test.size();
+    header.validation_count = validation.size();
+    header.images_offset = key_dataset_images_offset(&header);
+
+    string temporary = path + ".tmp";
+    FILE *f = fopen(temporary.c_str(), "wb");
+    if(!f)
+    {
+	fprintf(stderr, "couldn't write %s\n", temporary.c_str());
+	return(false);
+    }
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(labels.data(), sizeof(int32_t), labels.size(), f);
+    fwrite(train.data(), sizeof(int32_t), train.size(), f);
+    fwrite(test.data(), sizeof(int32_t), test.size(), f);
+    fwrite(validation.data(), sizeof(int32_t), validation.size(), f);
+    vector<uint8_t> padding(header.images_offset - ftell(f), 0);
+    fwrite(padding.data(), 1, padding.size(), f);
+
+    Mat image(size, size, CV_8UC3);
+    for(int i = 0; i < header.count; i++)
+    {
+	Mat source = imread(filenames[i], IMREAD_COLOR);
+	if(source.empty())
+	{
+	    fprintf(stderr, "couldn't read %s\n", filenames[i].c_str());
+	    fclose(f);
+	    remove(temporary.c_str());
+	    return(false);
+	}
+	resize(source, image, image.size(), 0, 0, INTER_AREA);
+	fwrite(image.data, 1, key_dataset_image_bytes(&header), f);
+    }
+    bool written = fflush(f) == 0 && !ferror(f);
+    written = fclose(f) == 0 && written;
+    if(!written || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+	fprintf(stderr, "couldn't finish writing %s\n", path.c_str());
+	remove(temporary.c_str());
+	return(false);
+    }
+    return(true);
+}
+#endif
@@ -1,9 +1,18 @@
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/video/tracking.hpp"
+#include "opencv2/calib3d/calib3d.hpp"
 #include <iostream>
 #include <stdio.h>
+#include <string.h>
+#include <chrono>
 #include <unordered_map>
+#include <algorithm>
 #include "neural_net.cpp"
+#include "key_classifier.cpp"
+#include "../common/rect_morphology.cpp"
+#include "../common/label_bounds.cpp"
+#include "../common/video_source.cpp"
 
 using namespace cv;
 //For compatibility with opencv2
@@ -13,17 +22,138 @@ namespace cv
 }
 
 //./keyboard_tracker /mnt/c/Users/Sasha/Downloads/keyboard.png
+
+/*
+  frequency domain filtering. the frame is padded (by reflection, so the frame's border doesn't
+  become an edge) out to a size dft is fast at, and transformed with a real dft: for real input
+  the spectrum is conjugate symmetric, so opencv packs the half it needs into a single channel
+  the size of the input (the CCS layout) instead of a two channel complex Mat twice as big.
+  the radial mask is laid out the same way, every element holds the response for the frequency
+  whose real or imaginary part sits there, so filtering is one elementwise multiply.
+  masks are built once per padded frame size and kept.
+  the response is a butterworth curve rather than a hard cutoff, which rings a lot less.
+  cutoffs are fractions of the nyquist frequency.
+ */
+enum { LOW_PASS, HIGH_PASS, BAND_PASS };
+#define BUTTERWORTH_ORDER 2
+
+struct frequency_filter
+{
+    int kind;
+    float low;  //high pass and band pass cut below this
+    float high; //low pass and band pass cut above this
+    vector<Size> mask_sizes;
+    vector<Mat> masks;
+    Mat padded_gray;
+    Mat padded;
+    Mat spectrum;
+    Mat filtered;
+};
+
+void init_frequency_filter(frequency_filter *f, int kind, float low, float high)
+{
+    CV_Assert(low > 0.0f && high > 0.0f);
+    f->kind = kind;
+    f->low = low;
+    f->high = high;
+    f->mask_sizes.clear();
+    f->masks.clear();
+}
+
+float butterworth_low(float r, float cutoff)
+{
+    return(1.0f / (1.0f + powf(r / cutoff, 2 * BUTTERWORTH_ORDER)));
+}
+
+float frequency_response(const frequency_filter *f, float r)
+{
+    switch(f->kind)
+    {
+    case LOW_PASS:
+	return(butterworth_low(r, f->high));
+    case HIGH_PASS:
+	return(1.0f - butterworth_low(r, f->low));
+    default:
+	return((1.0f - butterworth_low(r, f->low)) * butterworth_low(r, f->high));
+    }
+}
+
+/*
+  in CCS the first column (and the last, when there's an even number of columns) holds the
+  columns' zero (and nyquist) frequency, packed down the rows as re, im pairs. every other pair
+  of columns is the real and imaginary part of one horizontal frequency for all the rows.
+ */
+void build_ccs_mask(const frequency_filter *f, Size size, Mat &mask)
+{
+    int rows = size.height;
+    int cols = size.width;
+    mask.create(size, CV_32F);
+    for(int y = 0; y < rows; y++)
+    {
+	float *m = mask.ptr<float>(y);
+	for(int x = 0; x < cols; x++)
+	{
+	    bool packed_column = x == 0 || (cols % 2 == 0 && x == cols - 1);
+	    int u = packed_column ? (x == 0 ? 0 : cols / 2) : (x + 1) / 2;
+	    int v = packed_column ? (y + 1) / 2 : std::min(y, rows - y);
+	    float fu = (float)u / cols;
+	    float fv = (float)v / rows;
+	    m[x] = frequency_response(f, 2.0f * sqrtf(fu * fu + fv * fv));
+	}
+    }
+}
+
+const Mat &ccs_mask(frequency_filter *f, Size size)
+{
+    for(int i = 0; i < (int)f->mask_sizes.size(); i++)
+    {
+	if(f->mask_sizes[i] == size)
+	    return(f->masks[i]);
+    }
+    f->mask_sizes.push_back(size);
+    f->masks.push_back(Mat());
+    build_ccs_mask(f, size, f->masks.back());
+    return(f->masks.back());
+}
+
+//filters an 8 bit gray image, the result is 8 bit and the same size (negative responses clip to 0)
+const Mat &filter_frequencies(frequency_filter *f, const Mat &gray)
+{
+    int rows = getOptimalDFTSize(gray.rows);
+    int cols = getOptimalDFTSize(gray.cols);
+    copyMakeBorder(gray, f->padded_gray, 0, rows - gray.rows, 0, cols - gray.cols, BORDER_REFLECT);
+    f->padded_gray.convertTo(f->padded, CV_32F);
+
+    dft(f->padded, f->spectrum);
+    multiply(f->spectrum, ccs_mask(f, f->spectrum.size()), f->spectrum);
+    dft(f->spectrum, f->padded, DFT_INVERSE | DFT_REAL_OUTPUT | DFT_SCALE);
+
+    f->padded(Rect(0, 0, gray.cols, gray.rows)).convertTo(f->filtered, CV_8U);
+    return(f->filtered);
+}
+
+//swaps top left with bottom right and top right with bottom left, in place, so the zero frequency lands in the middle
+void switch_quadrants(Mat &mag)
+{
+    int cx = mag.cols / 2;
+    int cy = mag.rows / 2;
+    size_t half = cx * mag.elemSize();
+    for(int y = 0; y < cy; y++)
+    {
+	uchar *top = mag.ptr(y);
+	uchar *bottom = mag.ptr(y + cy);
+	std::swap_ranges(top, top + half, bottom + half);
+	std::swap_ranges(top + half, top + 2 * half, bottom);
+    }
+}
+
+//log magnitude spectrum of a gray image for looking at, zero frequency in the middle
 Mat fft(Mat gray)
 {
-    Mat fft;
-    gray.convertTo(fft, CV_32F);
-    dft(fft, fft, DFT_SCALE | DFT_COMPLEX_OUTPUT);
-    return(fft);
-    
     Mat padded;
     int m = getOptimalDFTSize(gray.rows);
     int n = getOptimalDFTSize(gray.cols);
-    copyMakeBorder(gray, padded, m - gray.rows, 0, n - gray.cols, 0, BORDER_CONSTANT, Scalar::all(0));
+    copyMakeBorder(gray, padded, 0, m - gray.rows, 0, n - gray.cols, BORDER_CONSTANT, Scalar::all(0));
 
     Mat planes[] = { Mat_<float>(padded), Mat::zeros(padded.size(), CV_32F) };
     Mat complex;
@@ -35,49 +165,37 @@ Mat fft(Mat gray)
     mag += Scalar::all(1);
     log(mag, mag);
     mag = mag(Rect(0, 0, mag.cols & -2, mag.rows & -2));
+    switch_quadrants(mag);
     normalize(mag, mag, 0, 1, CV_MINMAX);
     return(mag);
 }
 
-Mat ifft(Mat fft)
-{
-    Mat ifft;
-    dft(fft, ifft, DFT_INVERSE | DFT_REAL_OUTPUT);
-    ifft.convertTo(ifft, CV_8U);
-    return(ifft);
-}
-
-Mat switch_quadrants(Mat src)
+//zeroes every pixel of mask whose label has drop[label] set, in one pass. drop[0] is the background
+void remove_labels(Mat &mask, const Mat &labels, const vector<uchar> &drop)
 {
-    Mat mag;
-    src.copyTo(mag);
-    int cx = mag.cols / 2;
-    int cy = mag.rows / 2;
-
-    Mat q0(mag, Rect(0, 0, cx, cy));   // Top-Left - Create a ROI per quadrant
-    Mat q1(mag, Rect(cx, 0, cx, cy));  // Top-Right
-    Mat q2(mag, Rect(0, cy, cx, cy));  // Bottom-Left
-    Mat q3(mag, Rect(cx, cy, cx, cy)); // Bottom-Right
-    
-    Mat tmp;                           // swap quadrants (Top-Left with Bottom-Right)
-    q0.copyTo(tmp);
-    q3.copyTo(q0);
-    tmp.copyTo(q3);
-    q1.copyTo(tmp);                    // swap quadrant (Top-Right with Bottom-Left)
-    q2.copyTo(q1);
-    tmp.copyTo(q2);
-        
-    return(mag);
+    for(int y = 0; y < mask.rows; y++)
+    {
+	const int *l = labels.ptr<int>(y);
+	uchar *m = mask.ptr<uchar>(y);
+	for(int x = 0; x < mask.cols; x++)
+	{
+	    if(drop[l[x]])
+		m[x] = 0;
+	}
+    }
 }
 
-Mat high_pass(Mat src)
+//marks the components that are more than HW_THRESH times taller than they are wide
+void drop_tall_components(const vector<Rect> &bounds, vector<uchar> &drop)
 {
-#define HIGHPASS_THRESH 0.0f
-    Mat fft_img = fft(src);
-    threshold(fft_img, fft_img, HIGHPASS_THRESH, 1.0f, THRESH_TOZERO);
-    Mat orig = ifft(fft_img);
-    return(orig);
-#undef HIGHPASS_THRESH
+#define HW_THRESH 2.0f
+    drop.assign(bounds.size() + 1, 0);
+    for(int i = 0; i < (int)bounds.size(); i++)
+    {
+	const Rect &r = bounds[i];
+	drop[i + 1] = (float)r.height / (float)r.width > HW_THRESH;
+    }
+#undef HW_THRESH
 }
 
 void laplacian_keyboard_identifier(Mat src)
@@ -102,35 +220,23 @@ void laplacian_keyboard_identifier(Mat src)
     morphologyEx(orig, orig, MORPH_DILATE, se5);
 
     Mat key_image;
-    int components = connectedComponents(orig, key_image);
+    vector<Rect> bounds;
+    vector<uchar> drop;
+    int components = connectedComponents(orig, key_image, 8, CV_32S);
     printf("found %d components\n", components);
-    for(int i = 1; i < components; i++)
-    {
-#define HW_THRESH 2.0f
-	Mat component_i;
-	inRange(key_image, Scalar(i), Scalar(i), component_i);
-	Rect r = boundingRect(component_i);
-	if((float)r.size().height / (float)r.size().width > HW_THRESH)
-	{
-	    component_i /= i;
-	    component_i *= 255;
-	    orig -= component_i;
-	}
-#undef HW_THRESH
-    }
+    label_bounds(key_image, components, bounds);
+    drop_tall_components(bounds, drop);
+    remove_labels(orig, key_image, drop);
 //    morphologyEx(orig, orig, MORPH_DILATE, se5);
     morphologyEx(orig, orig, MORPH_ERODE, se5);
     morphologyEx(orig, orig, MORPH_DILATE, se13);
     
-    components = connectedComponents(orig, key_image);
+    components = connectedComponents(orig, key_image, 8, CV_32S);
     printf("found %d components\n", components);
 
-    Mat color_orig;
-    for(int i = 1; i < components; i++)
+    label_bounds(key_image, components, bounds);
+    for(const Rect &r : bounds)
     {
-	Mat component_i;
-	inRange(key_image, Scalar(i), Scalar(i), component_i);
-	Rect r = boundingRect(component_i);
 	rectangle(src, r.tl(), r.br(), Scalar(0, 0, 255), 1);
     }
     namedWindow("Keyboard Identifier");
@@ -148,123 +254,506 @@ bool filter_rectangles(Rect r, Size size)
 	   0.05 < height_ratio && height_ratio < 0.2f);
 }    
 
-//TODO(sasha): optimize?
+int find_root(vector<int> &parent, int i)
+{
+    while(parent[i] != i)
+    {
+	parent[i] = parent[parent[i]];
+	i = parent[i];
+    }
+    return(i);
+}
+
+/*
+  replaces every group of rectangles that overlap, directly or through a chain of others, with
+  the group's bounding box. a bounding box can reach rectangles none of its parts touched, so it
+  goes round again on the boxes until nothing overlaps any more.
+  each round sorts by x and sweeps, keeping the rectangles the sweep is still inside in a grid of
+  rows about a rectangle tall, so a rectangle is only tested against open ones that share a row
+  with it instead of everything open, which is all of them when the boxes are wide. a rectangle
+  is dropped from a row the first time the sweep finds it has passed its right edge, and
+  union-find collects the groups.
+  touching edges don't count, same as (a & b).area() > 0. the boxes come out in the order of
+  the first rectangle in each group.
+ */
 void join_overlapping_rectangles(vector<Rect> &rects)
 {
-    for(int i = 0; i < rects.size() - 1; i++)
+    vector<int> order;
+    vector<int> parent;
+    vector<int> slot;
+    vector<int> tested;
+    vector<vector<int> > rows;
+    vector<Rect> joined;
+    while(rects.size() > 1)
     {
-	for(int j = i + 1; j < rects.size(); j++)
+	int n = rects.size();
+	order.resize(n);
+	parent.resize(n);
+	for(int i = 0; i < n; i++)
+	    order[i] = parent[i] = i;
+	std::sort(order.begin(), order.end(), [&rects](int a, int b) { return(rects[a].x < rects[b].x); });
+
+	int top = rects[0].y, bottom = rects[0].y + rects[0].height;
+	int64_t heights = 0;
+	for(const Rect &r : rects)
 	{
-	    Rect intersection = rects[i] & rects[j];
-	    Rect minimum_enclosing = rects[i] | rects[j];
-	    if(intersection.area() > 0)
+	    top = std::min(top, r.y);
+	    bottom = std::max(bottom, r.y + r.height);
+	    heights += std::max(r.height, 0);
+	}
+	int row_height = std::max((int)(heights / n), 1);
+	rows.resize((bottom - top) / row_height + 1);
+	for(vector<int> &row : rows)
+	    row.clear();
+	tested.assign(n, -1);
+
+	for(int a = 0; a < n; a++)
+	{
+	    const Rect &r = rects[order[a]];
+	    if(r.width <= 0 || r.height <= 0)
+		continue;
+	    int last_row = (r.y + r.height - 1 - top) / row_height;
+	    for(int y = (r.y - top) / row_height; y <= last_row; y++)
 	    {
-		rects[i] = minimum_enclosing;
-		rects.erase(rects.begin() + j--);
+		vector<int> &open = rows[y];
+		for(size_t j = 0; j < open.size(); )
+		{
+		    const Rect &s = rects[open[j]];
+		    if(s.x + s.width <= r.x)
+		    {
+			open[j] = open.back();
+			open.pop_back();
+			continue;
+		    }
+		    if(tested[open[j]] != a && std::max(r.y, s.y) < std::min(r.y + r.height, s.y + s.height))
+		    {
+			int root_r = find_root(parent, order[a]);
+			int root_s = find_root(parent, open[j]);
+			if(root_r != root_s)
+			    parent[std::max(root_r, root_s)] = std::min(root_r, root_s);
+		    }
+		    tested[open[j]] = a;
+		    j++;
+		}
+		open.push_back(order[a]);
 	    }
 	}
+
+	slot.assign(n, -1);
+	joined.clear();
+	for(int i = 0; i < n; i++)
+	{
+	    int root = find_root(parent, i);
+	    if(slot[root] < 0)
+	    {
+		slot[root] = joined.size();
+		joined.push_back(rects[i]);
+	    }
+	    else
+		joined[slot[root]] |= rects[i];
+	}
+	bool done = joined.size() == rects.size();
+	rects.swap(joined);
+	if(done)
+	    break;
     }
 }
 
-Mat src;
-Mat gray_orig;
-Mat gray;
-int thresh = 30;
-int max_thresh = 255;
+struct key_score
+{
+    float mean;
+    float contrast;     //standard deviation of the intensity
+    float edge_density; //fraction of the pixels that are canny edges
+};
+
+/*
+  buffers that a keyboard tracker reuses between frames. every frame from the same camera (or
+  every trackbar drag) is the same size, so after the first call nothing needs reallocating.
+  the rectangle sizes only get recomputed when the image width (which they're scaled by) changes.
+ */
+struct keyboard_workspace
+{
+    int kernel_width;
+    Size se3;
+    Size se5;
+    rect_morph_buffers morph;
+    Mat gray;
+    Mat edges;
+    Mat contour_img;
+    Mat gray_contours;
+    Mat key_image;
+    vector<vector<Point> > contours;
+    vector<Vec4i> hierarchy;
+    vector<Rect> bounds;
+    vector<uchar> drop;
+    vector<Rect> keys;
+    int mask_components;
+    int key_components;
+    Mat gray_sum;
+    Mat gray_sq_sum;
+    Mat edge_sum;
+    vector<key_score> scores;
+    vector<Rect> scored_keys;
+};
+
+void update_kernels(keyboard_workspace *ws, int width)
+{
+    if(ws->kernel_width == width)
+	return;
+    ws->kernel_width = width;
 
-int blur_std = 0;
-int max_blur_std = 20;
+    //we map 800x300 to 1
+    float se_proportion = width / 800.0f;
+    int _3 = 3 * se_proportion;
+    int _5 = 5 * se_proportion;
+    ws->se3 = Size(_3, _3);
+    ws->se5 = Size(_5, _5);
+}
 
-int blur_size = 1;
-int max_blur_size = 10;
+/*
+  the contour tracker split into stages so they can be timed on their own:
+  keyboard_gray blurs a gray copy of the frame, keyboard_edges draws its canny contours,
+  keyboard_mask turns those into a mask of key faces, and keyboard_keys pulls the key rectangles
+  out of the mask.
+ */
+void keyboard_gray(keyboard_workspace *ws, const Mat &frame, int blur_size)
+{
+    int real_blur_size = 2 * blur_size + 1;
+    cvtColor(frame, ws->gray, COLOR_BGR2GRAY);
+    blur(ws->gray, ws->gray, Size(real_blur_size, real_blur_size));
+//    GaussianBlur(ws->gray, ws->gray, Size(real_blur_size, real_blur_size), blur_std);
+}
 
-void contour_keyboard_tracker()
+void keyboard_edges(keyboard_workspace *ws, Mat gray, int canny_thresh)
 {
-    Mat edges;
-    Canny(gray, edges, thresh, thresh * 3, 3);
+    update_kernels(ws, gray.cols);
 
-    vector<vector<Point> > contours;
-    vector<Vec4i> hierarchy;
+    Mat &edges = ws->edges;
+    Canny(gray, edges, canny_thresh, canny_thresh * 3, 3);
+    //before findContours, older opencvs scribble on its input
+    integral(edges, ws->edge_sum, CV_32S);
+
+    vector<vector<Point> > &contours = ws->contours;
+    vector<Vec4i> &hierarchy = ws->hierarchy;
     
     findContours(edges, contours, hierarchy, CV_RETR_TREE, CV_CHAIN_APPROX_NONE, Point(0, 0));
 
-    Mat contour_img = Mat::zeros(edges.size(), CV_8UC3); 
+    Mat &contour_img = ws->contour_img;
+    contour_img.create(edges.size(), CV_8UC3);
+    contour_img = Scalar::all(0);
     for(int i = 0; i < contours.size(); i++)
     {
 	drawContours(contour_img, contours, i, Scalar(0, 0, 255), 1, 8, hierarchy, 0, Point());
     }
 
-    Mat gray_contours;
-    cvtColor(contour_img, gray_contours, COLOR_BGR2GRAY);
+    cvtColor(contour_img, ws->gray_contours, COLOR_BGR2GRAY);
+}
 
-    //we map 800x300 to 1
-    float se_proportion = src.cols / 800.0f;
+void keyboard_mask(keyboard_workspace *ws)
+{
+    Size se3 = ws->se3;
+    Size se5 = ws->se5;
+    rect_morph_buffers *morph = &ws->morph;
+    Mat &gray_contours = ws->gray_contours;
 
-    int _1 = 1 * se_proportion;
-    int _3 = 3 * se_proportion;
-    int _5 = 5 * se_proportion;
-    int _7 = 7 * se_proportion;
-    int _9 = 9 * se_proportion;
-    int _11 = 11 * se_proportion;
-    int _13 = 13 * se_proportion;
-    
-    Mat se1 = getStructuringElement(MORPH_RECT, Size(_1, _1));
-    Mat se3 = getStructuringElement(MORPH_RECT, Size(_3, _3));
-    Mat se5 = getStructuringElement(MORPH_RECT, Size(_5, _5));
-    Mat se7 = getStructuringElement(MORPH_RECT, Size(_7, _7));
-    Mat se9 = getStructuringElement(MORPH_RECT, Size(_9, _9));
-    Mat se11 = getStructuringElement(MORPH_RECT, Size(_11, _11));
-    Mat se13 = getStructuringElement(MORPH_RECT, Size(_13, _13));
-    
-    morphologyEx(gray_contours, gray_contours, MORPH_DILATE, se5);
-//    morphologyEx(gray_contours, gray_contours, MORPH_ERODE, se3);
+    rect_morphology(gray_contours, gray_contours, MORPH_DILATE, se5, morph);
+//    rect_morphology(gray_contours, gray_contours, MORPH_ERODE, se3, morph);
 
-    gray_contours = Scalar::all(255) - gray_contours;
+    bitwise_not(gray_contours, gray_contours);
     inRange(gray_contours, Scalar(255), Scalar(255), gray_contours);
-    morphologyEx(gray_contours, gray_contours, MORPH_DILATE, se5);
-    morphologyEx(gray_contours, gray_contours, MORPH_ERODE, se3);
+    rect_morphology(gray_contours, gray_contours, MORPH_DILATE, se5, morph);
+    rect_morphology(gray_contours, gray_contours, MORPH_ERODE, se3, morph);
 
 
-    Mat key_image;
-    int components = connectedComponents(gray_contours, key_image);
-    printf("found %d components\n", components);
-    for(int i = 1; i < components; i++)
+    Mat &key_image = ws->key_image;
+    int components = connectedComponents(gray_contours, key_image, 8, CV_32S);
+    ws->mask_components = components;
+    label_bounds(key_image, components, ws->bounds);
+    drop_tall_components(ws->bounds, ws->drop);
+    remove_labels(gray_contours, key_image, ws->drop);
+
+    rect_morphology(gray_contours, gray_contours, MORPH_ERODE, se3, morph);
+    rect_morphology(gray_contours, gray_contours, MORPH_DILATE, se5, morph);
+    rect_morphology(gray_contours, gray_contours, MORPH_ERODE, se5, morph);
+    rect_morphology(gray_contours, gray_contours, MORPH_DILATE, se3, morph);
+}
+
+const vector<Rect> &keyboard_keys(keyboard_workspace *ws, Size size)
+{
+    Mat &key_image = ws->key_image;
+    int components = connectedComponents(ws->gray_contours, key_image, 8, CV_32S);
+    ws->key_components = components;
+    label_bounds(key_image, components, ws->bounds);
+
+    vector<Rect> &keys = ws->keys;
+    keys.clear();
+    for(const Rect &r : ws->bounds)
     {
-#define HW_THRESH 2.0f
-	Mat component_i;
-	inRange(key_image, Scalar(i), Scalar(i), component_i);
-	Rect r = boundingRect(component_i);
-	if((float)r.size().height / (float)r.size().width > HW_THRESH)
+	if(filter_rectangles(r, size))
 	{
-	    component_i /= i;
-	    component_i *= 255;
-	    gray_contours -= component_i;
+	    keys.push_back(r);
 	}
-#undef HW_THRESH
     }
+    join_overlapping_rectangles(keys);
+    return(keys);
+}
 
-    morphologyEx(gray_contours, gray_contours, MORPH_ERODE, se3);
-    morphologyEx(gray_contours, gray_contours, MORPH_DILATE, se5);
-    morphologyEx(gray_contours, gray_contours, MORPH_ERODE, se5);
-    morphologyEx(gray_contours, gray_contours, MORPH_DILATE, se3);
-    
-    components = connectedComponents(gray_contours, key_image);
-    printf("found %d components\n", components);
+/*
+  a key is a lightish, fairly flat patch with a legend on it, so it has some contrast and some
+  edges but not many. with integral images of the gray frame, its square and the canny edges
+  (made once per frame), the mean, contrast and edge density of any rectangle are four lookups
+  each, so every candidate gets scored for about the cost of a pixel and the ones that can't be
+  keys are dropped before anything expensive like the classifier looks at them.
+ */
+#define KEY_MIN_CONTRAST 6.0f
+#define KEY_MIN_EDGE_DENSITY 0.01f
+#define KEY_MAX_EDGE_DENSITY 0.3f
+
+template<typename T>
+T rect_sum(const Mat &sum, const Rect &r)
+{
+    return(sum.at<T>(r.y + r.height, r.x + r.width) - sum.at<T>(r.y, r.x + r.width)
+	   - sum.at<T>(r.y + r.height, r.x) + sum.at<T>(r.y, r.x));
+}
+
+key_score score_key(const keyboard_workspace *ws, Rect r)
+{
+    key_score score = { 0.0f, 0.0f, 0.0f };
+    r &= Rect(0, 0, ws->gray_sum.cols - 1, ws->gray_sum.rows - 1);
+    if(r.area() == 0)
+	return(score);
+    double area = r.area();
+    double mean = rect_sum<int>(ws->gray_sum, r) / area;
+    double variance = rect_sum<double>(ws->gray_sq_sum, r) / area - mean * mean;
+    score.mean = mean;
+    score.contrast = sqrt(std::max(variance, 0.0));
+    score.edge_density = rect_sum<int>(ws->edge_sum, r) / (255.0 * area);
+    return(score);
+}
+
+//keeps the keys that score like keys, ws->scores lines up with what's returned
+const vector<Rect> &keyboard_score(keyboard_workspace *ws, const Mat &gray)
+{
+    /*
+      a 4k frame of 255s sums to 2.1e9, just inside an int, so the plain sums stay CV_32S. its
+      squares would reach 5.4e11, so the squared sum is CV_64F, as cv::integral makes it by default.
+     */
+    integral(gray, ws->gray_sum, ws->gray_sq_sum, CV_32S, CV_64F);
+
+    ws->scored_keys.clear();
+    ws->scores.clear();
+    for(const Rect &r : ws->keys)
+    {
+	key_score score = score_key(ws, r);
+	if(score.contrast >= KEY_MIN_CONTRAST &&
+	   score.edge_density >= KEY_MIN_EDGE_DENSITY && score.edge_density <= KEY_MAX_EDGE_DENSITY)
+	{
+	    ws->scored_keys.push_back(r);
+	    ws->scores.push_back(score);
+	}
+    }
+    return(ws->scored_keys);
+}
 
+struct keyboard_params
+{
+    int canny_thresh;
+    int blur_size; //the box blur is 2 * blur_size + 1 wide
+};
+
+keyboard_params default_keyboard_params()
+{
+    keyboard_params params;
+    params.canny_thresh = 30;
+    params.blur_size = 1;
+    return(params);
+}
+
+/*
+  the contour tracker with everything it touches inside it: no globals and no windows, so each
+  camera or worker thread can have its own and run them side by side.
+ */
+struct KeyboardTracker
+{
+    keyboard_params params;
+    keyboard_workspace ws;
+
+    KeyboardTracker(keyboard_params p = default_keyboard_params()) : params(p), ws() {}
+
+    vector<Rect> detect(const Mat &frame)
+    {
+	keyboard_gray(&ws, frame, params.blur_size);
+	keyboard_edges(&ws, ws.gray, params.canny_thresh);
+	keyboard_mask(&ws);
+	keyboard_keys(&ws, frame.size());
+	return(keyboard_score(&ws, ws.gray));
+    }
+};
+
+/*
+  the keyboard barely moves while the arm works in front of it, so instead of segmenting every
+  frame we segment once, pick corners on the keys, and follow them with pyramidal lucas-kanade.
+  a ransac homography from the first frame's corners to the current ones moves the whole key
+  layout along. we only segment again when the layout can't be trusted: too few corners
+  survived, too few of them agree with the homography, or the homography squashes or blows up
+  the keyboard more than a camera move could.
+ */
+#define LAYOUT_MAX_CORNERS 200
+#define LAYOUT_MIN_CORNERS 12
+#define LAYOUT_MIN_CONFIDENCE 0.6f
+#define LAYOUT_MAX_SCALE_CHANGE 1.5f
+
+struct key_layout_tracker
+{
+    KeyboardTracker segmenter;
+    bool tracking;
+    vector<Rect> layout;            //the keys in the frame we segmented
+    vector<Point2f> layout_corners; //corners in the segmented frame
+    vector<Point2f> corners;        //the same corners in the previous frame
+    vector<Point2f> next_corners;
+    vector<uchar> status;
+    vector<float> error;
+    Mat previous_gray;
+    Mat gray;
+    Mat corner_mask;
+    Mat inliers;
+    vector<Point2f> key_corners;
     vector<Rect> keys;
-    Mat color_orig(src);
-    for(int i = 1; i < components; i++)
+    float confidence;
+    long segmented_frames;
+    long tracked_frames;
+};
+
+void init_layout_tracker(key_layout_tracker *t)
+{
+    t->tracking = false;
+    t->confidence = 0.0f;
+    t->segmented_frames = 0;
+    t->tracked_frames = 0;
+}
+
+void segment_layout(key_layout_tracker *t, const Mat &frame)
+{
+    t->segmented_frames++;
+    t->layout = t->segmenter.detect(frame);
+    t->keys = t->layout;
+    cvtColor(frame, t->gray, COLOR_BGR2GRAY);
+
+    //corners only from the keys themselves, the desk and the arm move differently
+    t->corner_mask.create(t->gray.size(), CV_8UC1);
+    t->corner_mask = Scalar::all(0);
+    for(const Rect &r : t->layout)
+	rectangle(t->corner_mask, r, Scalar(255), -1);
+    goodFeaturesToTrack(t->gray, t->layout_corners, LAYOUT_MAX_CORNERS, 0.01, 5, t->corner_mask);
+
+    t->corners = t->layout_corners;
+    t->tracking = t->layout_corners.size() >= LAYOUT_MIN_CORNERS;
+    t->confidence = t->tracking ? 1.0f : 0.0f;
+    std::swap(t->gray, t->previous_gray);
+}
+
+//moves every key of the layout through h, a key stays the bounding box of its warped corners
+void warp_layout(key_layout_tracker *t, const Mat &h)
+{
+    t->key_corners.clear();
+    for(const Rect &r : t->layout)
+    {
+	t->key_corners.push_back(Point2f(r.x, r.y));
+	t->key_corners.push_back(Point2f(r.x + r.width, r.y));
+	t->key_corners.push_back(Point2f(r.x + r.width, r.y + r.height));
+	t->key_corners.push_back(Point2f(r.x, r.y + r.height));
+    }
+    t->keys.clear();
+    if(t->key_corners.empty())
+	return;
+    perspectiveTransform(t->key_corners, t->key_corners, h);
+    for(int i = 0; i < (int)t->key_corners.size(); i += 4)
+    {
+	const Point2f *quad = &t->key_corners[i];
+	float left = std::min(std::min(quad[0].x, quad[1].x), std::min(quad[2].x, quad[3].x));
+	float right = std::max(std::max(quad[0].x, quad[1].x), std::max(quad[2].x, quad[3].x));
+	float top = std::min(std::min(quad[0].y, quad[1].y), std::min(quad[2].y, quad[3].y));
+	float bottom = std::max(std::max(quad[0].y, quad[1].y), std::max(quad[2].y, quad[3].y));
+	t->keys.push_back(Rect(Point(cvFloor(left), cvFloor(top)), Point(cvCeil(right), cvCeil(bottom))));
+    }
+}
+
+//ratio of the keyboard's area after h to before, anything far from 1 is a bad fit not a camera move
+float layout_scale_change(key_layout_tracker *t)
+{
+    Rect before = t->layout.empty() ? Rect() : t->layout[0];
+    Rect after = t->keys.empty() ? Rect() : t->keys[0];
+    for(const Rect &r : t->layout)
+	before |= r;
+    for(const Rect &r : t->keys)
+	after |= r;
+    return(before.area() > 0 ? (float)after.area() / before.area() : 0.0f);
+}
+
+const vector<Rect> &track_layout(key_layout_tracker *t, const Mat &frame)
+{
+    if(!t->tracking)
+    {
+	segment_layout(t, frame);
+	return(t->keys);
+    }
+
+    cvtColor(frame, t->gray, COLOR_BGR2GRAY);
+    calcOpticalFlowPyrLK(t->previous_gray, t->gray, t->corners, t->next_corners, t->status, t->error);
+
+    //drop the corners we lost, keeping layout_corners lined up with corners
+    int kept = 0;
+    for(int i = 0; i < (int)t->corners.size(); i++)
+    {
+	if(!t->status[i])
+	    continue;
+	t->layout_corners[kept] = t->layout_corners[i];
+	t->corners[kept] = t->next_corners[i];
+	kept++;
+    }
+    t->layout_corners.resize(kept);
+    t->corners.resize(kept);
+    std::swap(t->gray, t->previous_gray);
+    if(kept < LAYOUT_MIN_CORNERS)
     {
-	Mat component_i;
-	inRange(key_image, Scalar(i), Scalar(i), component_i);
-	Rect r = boundingRect(component_i);
-	if(filter_rectangles(r, src.size()))
+	segment_layout(t, frame);
+	return(t->keys);
+    }
+
+    Mat h = findHomography(t->layout_corners, t->corners, RANSAC, 3.0, t->inliers);
+    t->confidence = h.empty() ? 0.0f : (float)countNonZero(t->inliers) / kept;
+    if(t->confidence >= LAYOUT_MIN_CONFIDENCE)
+    {
+	warp_layout(t, h);
+	float scale = layout_scale_change(t);
+	if(scale > 1.0f / LAYOUT_MAX_SCALE_CHANGE && scale < LAYOUT_MAX_SCALE_CHANGE)
 	{
-	    keys.push_back(r);
+	    t->tracked_frames++;
+	    return(t->keys);
 	}
     }
-    join_overlapping_rectangles(keys);
-    for(Rect &r : keys)
+    segment_layout(t, frame);
+    return(t->keys);
+}
+
+Mat src;
+KeyboardTracker tracker;
+int max_thresh = 255;
+
+int blur_std = 0;
+int max_blur_std = 20;
+
+int max_blur_size = 10;
+
+void contour_keyboard_tracker()
+{
+    vector<Rect> keys = tracker.detect(src);
+    keyboard_workspace *ws = &tracker.ws;
+    printf("found %d components\n", ws->mask_components);
+    printf("found %d components\n", ws->key_components);
+
+    Mat color_orig = src.clone();
+    for(const Rect &r : keys)
     {
 	rectangle(color_orig, r.tl(), r.br(), Scalar(0, 0, 255), 1);
     }
@@ -272,8 +761,8 @@ void contour_keyboard_tracker()
     namedWindow("Contours");
     namedWindow("Gray");
     namedWindow("Output");
-    imshow("Contours", contour_img);
-    imshow("Gray", gray_contours);
+    imshow("Contours", ws->contour_img);
+    imshow("Gray", ws->gray_contours);
     imshow("Output", color_orig);
 }
 
@@ -289,15 +778,76 @@ void thresh_callback(int, void *)
 
 void blur_callback(int, void *)
 {
-    gray_orig.copyTo(gray);
-    int real_blur_size = 2 * blur_size + 1;
-    blur(gray, gray, Size(real_blur_size, real_blur_size));
-//    GaussianBlur(gray, gray, Size(real_blur_size, real_blur_size), blur_std);
     contour_keyboard_tracker();
 }
 
+//define KEYBOARD_TRACKER_NO_MAIN to include the tracker in another program (see common/tracker_bench.cpp)
+#ifndef KEYBOARD_TRACKER_NO_MAIN
+//follows the key layout through a video or camera, segmenting only when tracking gets lost
+int track_keyboard(const char *source)
+{
+    VideoCapture cap;
+    if(!open_video_source(cap, source))
+    {
+	fprintf(stderr, "couldn't open %s\n", source);
+	return(-1);
+    }
+
+    key_layout_tracker t;
+    init_layout_tracker(&t);
+    Mat frame;
+    while(cap.read(frame))
+    {
+	const vector<Rect> &keys = track_layout(&t, frame);
+	for(const Rect &r : keys)
+	    rectangle(frame, r.tl(), r.br(), Scalar(0, 0, 255), 1);
+	imshow("Keyboard", frame);
+	if(waitKey(1) == 27)
+	    break;
+    }
+    fprintf(stderr, "%ld frames tracked, %ld segmented\n", t.tracked_frames, t.segmented_frames);
+    return(0);
+}
+
+//finds the keys in an image and runs them all through the classifier as one batch
+int classify_image(const char *weights, const char *image_path)
+{
+    key_classifier model;
+    if(!load_key_classifier(weights, &model))
+	return(-1);
+    Mat image = imread(image_path, 1);
+    if(!image.data)
+	return(-1);
+
+    KeyboardTracker keyboard;
+    vector<Rect> keys = keyboard.detect(image);
+    key_batch batch;
+    init_key_batch(&batch);
+    cnn_workspace ws;
+    vector<int> labels;
+    vector<float> confidence;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    pack_key_crops(image, keys, &batch);
+    classify_keys(&model, batch.data, batch.count, &ws, labels, confidence);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    for(int i = 0; i < batch.count; i++)
+	printf("%d %d %d %d: class %d (%.2f)\n", keys[i].x, keys[i].y, keys[i].width, keys[i].height,
+	       labels[i], confidence[i]);
+    fprintf(stderr, "%d keys classified in %.3f ms\n", batch.count, ms);
+    free_key_batch(&batch);
+    return(0);
+}
+
 int main(int argc, char** argv)
 {
+    //./keyboard_tracker --track <camera index | video file>
+    if(argc >= 3 && strcmp(argv[1], "--track") == 0)
+	return(track_keyboard(argv[2]));
+    //./keyboard_tracker --classify keys.kcnn /mnt/c/Users/Sasha/Downloads/keyboard.png
+    if(argc >= 4 && strcmp(argv[1], "--classify") == 0)
+	return(classify_image(argv[2], argv[3]));
 #if 0
     /// Read the image
     src = imread(argv[1], 1);
@@ -308,13 +858,11 @@ int main(int argc, char** argv)
     if(!src.data)
 	return(-1);
 
-    cvtColor(src, gray_orig, COLOR_BGR2GRAY);
-
     namedWindow("Source");
     imshow("Source", src);
-    createTrackbar(" Canny thresh:", "Source", &thresh, max_thresh, thresh_callback);
+    createTrackbar(" Canny thresh:", "Source", &tracker.params.canny_thresh, max_thresh, thresh_callback);
     createTrackbar(" Blur std:", "Source", &blur_std, max_blur_std, blur_callback);
-    createTrackbar(" Blur size:", "Source", &blur_size, max_blur_size, blur_callback);
+    createTrackbar(" Blur size:", "Source", &tracker.params.blur_size, max_blur_size, blur_callback);
     blur_callback(0, 0);
 		 
 //    keyboard_identifier(src);
@@ -328,7 +876,10 @@ int main(int argc, char** argv)
 	cout << pair.first << endl;
     for(int i = 0; i < 10; i++)
     cout << filenames[i] << endl;*/
+#ifdef KEYBOARD_USE_TENSORFLOW
     cnn_model();
+#endif
 #endif
     return(0);
 }
+#endif
@@ -0,0 +1,110 @@
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "neural_net.cpp"
+#include "batch_loader.cpp"
+
+//./loader_bench keys.kdat
+//./loader_bench data.yml 4 64 20
+//./loader_bench keys.kdat 4 64 20 augment
+
+/*
+  pulls BENCH_EPOCHS epochs of training batches through the batch loader, from a dataset made by
+  make_dataset or straight from data.yml and its pngs, with a fake training step that just
+  spins for step_ms per batch, and prints the loader's throughput and how long the "trainer" had
+  to wait. run it with step_ms 0 to see how fast the loader goes flat out. with augment the
+  images are randomly distorted on the way, and the first batch is saved to augmented.png so the
+  distortions can be looked at.
+ */
+#define BENCH_EPOCHS 2
+
+void spin(double ms)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() < ms)
+	;
+}
+
+//up to 8 x 8 of the batch's images side by side, turned back into 8 bit
+void save_batch_preview(const loader_batch *batch, const batch_loader_params *params, const char *path)
+{
+    int size = params->image_size;
+    int shown = std::min(params->batch_size, 64);
+    int columns = std::min(shown, 8);
+    Mat preview((shown + columns - 1) / columns * size, columns * size, CV_8UC3, Scalar::all(0));
+    for(int i = 0; i < shown; i++)
+    {
+	Mat image(size, size, CV_32FC3, (void *)(batch->data.data() + (size_t)i * size * size * 3));
+	Mat tile = preview(Rect(i % columns * size, i / columns * size, size, size));
+	image.convertTo(tile, CV_8UC3, 1.0 / params->scale, -params->offset / params->scale);
+    }
+    imwrite(path, preview);
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+	fprintf(stderr, "usage: %s keys.kdat|data.yml [threads] [batch] [step_ms] [augment]\n", argv[0]);
+	return(-1);
+    }
+    string path = argv[1];
+    batch_loader_params params = default_batch_loader_params();
+    if(argc > 2)
+	params.threads = atoi(argv[2]);
+    if(argc > 3)
+	params.batch_size = atoi(argv[3]);
+    double step_ms = argc > 4 ? atof(argv[4]) : 10.0;
+    params.augment.enabled = argc > 5 && string(argv[5]) == "augment";
+
+    key_dataset ds;
+    vector<string> filenames;
+    vector<int32_t> labels, indices;
+    image_source source;
+    bool dataset = path.size() > 5 && path.substr(path.size() - 5) == ".kdat";
+    if(dataset)
+    {
+	if(!open_key_dataset(path.c_str(), &ds))
+	    return(-1);
+	source = dataset_source(&ds);
+	indices.assign(ds.train, ds.train + ds.header->train_count);
+    }
+    else
+    {
+	auto data_pair = read_data(path);
+	filenames = data_pair.second;
+	Mat label_values;
+	data_pair.first["ALLlabels"].convertTo(label_values, CV_32S);
+	label_values = label_values.reshape(1, 1);
+	for(int i = 0; i < label_values.cols; i++)
+	    labels.push_back(label_values.at<int32_t>(i) - 1);
+	labels.resize(filenames.size(), -1);
+	source = file_source(&filenames, labels.data());
+	indices = dataset_indices(data_pair.first["TRNind"], filenames.size());
+    }
+    if((int)indices.size() < params.batch_size)
+    {
+	fprintf(stderr, "only %zu training images, fewer than a batch of %d\n", indices.size(), params.batch_size);
+	return(-1);
+    }
+
+    batch_loader loader;
+    start_batch_loader(&loader, source, indices.data(), indices.size(), params);
+    int batches = loader.batches_per_epoch * BENCH_EPOCHS;
+    double checksum = 0.0;
+    for(int b = 0; b < batches; b++)
+    {
+	const loader_batch *batch = next_batch(&loader);
+	checksum += batch->data[0];
+	if(b == 0 && params.augment.enabled)
+	    save_batch_preview(batch, &params, "augmented.png");
+	spin(step_ms);
+	release_batch(&loader);
+    }
+    printf("%d batches of %d%s, %.1f ms per training step (checksum %g)\n", batches, params.batch_size,
+	   params.augment.enabled ? " augmented" : "", step_ms, checksum);
+    print_loader_stats(&loader, stdout);
+    stop_batch_loader(&loader);
+    if(dataset)
+	close_key_dataset(&ds);
+    return(0);
+}
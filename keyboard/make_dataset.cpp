@@ -0,0 +1,56 @@
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include <chrono>
+#include "neural_net.cpp"
+#include "key_dataset.cpp"
+
+//./make_dataset data.yml keys.kdat
+//./make_dataset data.yml keys.kdat 32
+//./make_dataset keys.kdat
+
+/*
+  turns data.yml (from matlab2opencv.m) and the English/ images it names into one mmappable
+  dataset file, with every image resized to 28x28 (or the size given). with just a dataset it
+  opens it and reports how long that took and what's in it.
+ */
+int report(const char *path)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    key_dataset ds;
+    if(!open_key_dataset(path, &ds))
+	return(-1);
+    double open_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    //reads every pixel through the Mat views, which is the first time the pages get touched
+    start = std::chrono::steady_clock::now();
+    double total = 0.0;
+    for(int i = 0; i < ds.header->count; i++)
+	total += sum(dataset_image(&ds, i))[0];
+    double read_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    const key_dataset_header *h = ds.header;
+    printf("%s: %d images of %dx%dx%d, %d train, %d test, %d validation, %.1f MB\n", path, h->count,
+	   h->image_size, h->image_size, h->channels, h->train_count, h->test_count, h->validation_count,
+	   ds.length / 1e6);
+    printf("opened in %.3f ms, read every pixel in %.1f ms (mean blue %.1f)\n", open_ms, read_ms,
+	   h->count ? total / h->count / (h->image_size * h->image_size) : 0.0);
+    close_key_dataset(&ds);
+    return(0);
+}
+
+int main(int argc, char** argv)
+{
+    if(argc == 2)
+	return(report(argv[1]));
+    if(argc < 3)
+    {
+	fprintf(stderr, "usage: %s data.yml keys.kdat [size] or %s keys.kdat\n", argv[0], argv[0]);
+	return(-1);
+    }
+    int size = argc > 3 ? atoi(argv[3]) : KEY_INPUT_SIZE;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if(!write_key_dataset(argv[1], argv[2], size))
+	return(-1);
+    printf("converted in %.1f s\n", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    return(report(argv[2]));
+}
@@ -1,99 +1,12 @@
+#include "gemm.cpp"
+#include "elementwise.cpp"
+
 vector<float> X { 5.1, 3.5, 1.4, 0.2, 4.9, 3.0, 1.4, 0.2, 6.2, 3.4, 5.4, 2.3, 5.9, 3.0, 5.1, 1.8 };
 
 vector<float> y { 0, 0, 1, 1 };
 
 vector<float> W { 0.5, 0.5, 0.5, 0.5 };
 
-vector<float> sigmoid_d(const vector<float> &m1)
-{
-    /*
-      Returns the value of the sigmoid function derivative f'(x) = f(x)(1 - f(x)),
-      where f(x) is sigmoid function.
-      Input: m1, a vector.
-      Output: x(1 - x) for every element of the input matrix m1.
-    */
-
-    const uint64_t VECTOR_SIZE = m1.size();
-    vector<float> output(VECTOR_SIZE);
-
-    for(uint64_t i = 0; i < VECTOR_SIZE; i++)
-	output[i] = m1[i] * (1 - m1[i]);
-
-    return(output);
-}
-
-vector<float> sigmoid(const vector<float> &m1)
-{
-    /*
-      Returns the value of the sigmoid function f(x) = 1/(1 + e^-x).
-      Input: m1, a vector.
-      Output: 1/(1 + e^-x) for every element of the input matrix m1.
-    */
-    const uint64_t VECTOR_SIZE = m1.size();
-    vector<float> output (VECTOR_SIZE);
-
-    for(uint64_t i = 0; i < VECTOR_SIZE; i++) 
-	output[i] = 1 / (1 + exp(-m1[i]));
-    
-    return(output);
-}
-
-vector<float> operator+(const vector<float> &m1, const vector<float> &m2)
-{
-    /*
-      Returns the elementwise sum of two vectors.
-      Inputs:
-      m1: a vector
-      m2: a vector
-      Output: a vector, sum of the vectors m1 and m2.
-    */
-
-    const uint64_t VECTOR_SIZE = m1.size();
-    vector<float> sum(VECTOR_SIZE);
-
-    for (uint64_t i = 0; i < VECTOR_SIZE; ++i)
-	sum[i] = m1[i] + m2[i];
-
-    return(sum);
-}
-
-vector<float> operator-(const vector<float> &m1, const vector<float> &m2)
-{
-    /*
-      Returns the difference between two vectors.
-      Inputs:
-      m1: vector
-      m2: vector
-      Output: vector, m1 - m2, difference between two vectors m1 and m2.
-    */
-
-    const uint64_t VECTOR_SIZE = m1.size();
-    vector<float> difference(VECTOR_SIZE);
-
-    for (uint64_t i = 0; i < VECTOR_SIZE; i++)
-	difference[i] = m1[i] - m2[i];
-
-    return(difference);
-}
-
-vector<float> operator*(const vector<float> &m1, const vector<float> &m2){
-
-    /*
-      Returns the product of two vectors (elementwise multiplication).
-      Inputs:
-      m1: vector
-      m2: vector
-      Output: vector, m1 * m2, product of two vectors m1 and m2
-    */
-    const uint64_t VECTOR_SIZE = m1.size();
-    vector <float> product(VECTOR_SIZE);
-
-    for (uint64_t i = 0; i < VECTOR_SIZE; i++)
-	product[i] = m1[i] * m2[i];
-    
-    return product;
-}
-
 vector<float> transpose(float *m, const int C, const int R)
 {
     /*
@@ -106,14 +19,7 @@ vector<float> transpose(float *m, const int C, const int R)
     */
 
     vector<float> mT(C*R);
-
-    for(uint64_t n = 0; n < C*R; n++)
-    {
-	uint64_t i = n/C;
-	uint64_t j = n%C;
-	mT[n] = m[R*j + i];
-    }
-    
+    transpose_blocked(m, C, R, mT.data());
     return mT;
 }
 
@@ -132,17 +38,7 @@ vector<float> dot(const vector<float> &m1, const vector<float> &m2, const int m1
     */
 
     vector <float> output (m1_rows*m2_columns);
-
-    for(int row = 0; row < m1_rows; row++)
-    {
-	for(int col = 0; col < m2_columns; col++)
-	{
-	    output[row * m2_columns + col] = 0.0f;
-	    for(int k = 0; k < m1_columns; k++)
-		output[ row * m2_columns + col ] += m1[ row * m1_columns + k ] * m2[ k * m2_columns + col ];
-	}
-    }
-
+    sgemm(m1_rows, m2_columns, m1_columns, m1.data(), m1_columns, m2.data(), m2_columns, output.data(), m2_columns);
     return output;
 }
 
@@ -449,19 +345,3 @@ vector<vector<Mat> > random_conv_layer_initialization(int filter_size, int num_i
     }
     return(result);
 }
-
-void train_nn()
-{
-    auto data_pair = read_data("data.yml");
-    auto data = data_pair.first;
-    auto filenames = data_pair.second;
-
-    for(int i = 0; i < filenames.size(); i++)
-    {
-	Mat _img = imread(filenames[i]);
-	Mat img;
-	_img.convertTo(img, CV_32FC3);
-	Mat bgr[3];
-	split(img, bgr);
-    }
-}
@@ -1,4 +1,7 @@
+//the tensorflow graph is only built with -DKEYBOARD_USE_TENSORFLOW (and -ltensorflow), the tracker classifies with key_classifier.cpp
+#ifdef KEYBOARD_USE_TENSORFLOW
 #include <tensorflow/c/c_api.h>
+#endif
 #include <iostream>
 #include <fstream>
 #include <stdint.h>
@@ -7,6 +10,9 @@
 #include <math.h>
 #include <string>
 #include <utility>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
 
 using namespace std;
 using namespace cv;
@@ -37,6 +43,7 @@ pair<unordered_map<string, Mat>, vector<string> > read_data(string filename)
     return(make_pair(matrices, filenames));
 }
 
+#ifdef KEYBOARD_USE_TENSORFLOW
 TF_Tensor *i32_tensor(const int64_t *dims, int num_dims, const int32_t *values)
 {
     int64_t num_values = 1;
@@ -62,11 +69,17 @@ TF_Output i32_const_arr(TF_Graph *graph, TF_Status *s, const char *name,
 			const int32_t *values, int value_size)
 {
     TF_OperationDescription *desc = TF_NewOperation(graph, "Const", name);
-    const int64_t dims[2];
+    int64_t dims[2];
     dims[0] = 1;
     dims[1] = value_size;
     TF_Tensor *tensor = i32_tensor(dims, 2, values);
+    TF_SetAttrTensor(desc, "value", tensor, s);
     TF_SetAttrType(desc, "dtype", TF_INT32);
+    TF_Output output;
+    output.oper = TF_FinishOperation(desc, s);
+    output.index = 0;
+    TF_DeleteTensor(tensor);
+    return(output);
 }
 
 TF_Output reshape(TF_Graph *graph, TF_Status *s, const char *name,
@@ -112,13 +125,13 @@ TF_Output relu(TF_Graph *graph, TF_Status *s, const char *name,
     return(output);
 }
 
-TF_Tensor *uint8_tensor(const int64_t *dims, int num_dims, uint64_t len)
+TF_Tensor *uint8_tensor(const int64_t *dims, int num_dims)
 {
     int64_t num_bytes = 1;
     for(int i = 0; i < num_dims; i++)
 	num_bytes *= dims[i];
     
-    return(TF_AllocateTensor(TF_UINT8, dims, num_dims, sizeof(uint8_t) * len));
+    return(TF_AllocateTensor(TF_UINT8, dims, num_dims, sizeof(uint8_t) * num_bytes));
 }
 
 TF_Graph *cnn_model()
@@ -136,35 +149,106 @@ TF_Graph *cnn_model()
     cout << "Status: " << TF_GetCode(s) << endl;
     return(graph);
 }
+#endif
+
+/*
+  the classifier takes 28x28 bgr crops, batched NHWC: crop after crop, each one row after row of
+  b, g, r pixels, which is just how a CV_8UC3 Mat already lays them out.
+ */
+#define KEY_INPUT_SIZE 28
+#define KEY_INPUT_CHANNELS 3
+#define KEY_INPUT_BYTES (KEY_INPUT_SIZE * KEY_INPUT_SIZE * KEY_INPUT_CHANNELS)
+
+//copies one image into dst as H x W x C, row by row so it works on ROIs too
+void pack_image(const Mat &image, uint8_t *dst)
+{
+    size_t row_bytes = image.cols * image.elemSize();
+    for(int y = 0; y < image.rows; y++)
+	memcpy(dst + y * row_bytes, image.ptr(y), row_bytes);
+}
+
+/*
+  one frame's worth of key crops in a single 64 byte aligned NHWC buffer. it only grows, so
+  once it has seen the biggest keyboard nothing gets allocated again. each crop is resized
+  straight into its slot through a Mat header over the buffer, no per-key temporaries.
+ */
+struct key_batch
+{
+    int capacity;
+    int count;
+    uint8_t *data;
+};
+
+void init_key_batch(key_batch *batch)
+{
+    batch->capacity = 0;
+    batch->count = 0;
+    batch->data = nullptr;
+}
+
+void free_key_batch(key_batch *batch)
+{
+    free(batch->data);
+    init_key_batch(batch);
+}
+
+void reserve_key_batch(key_batch *batch, int count)
+{
+    if(count <= batch->capacity)
+	return;
+    void *data = nullptr;
+    if(posix_memalign(&data, 64, (size_t)count * KEY_INPUT_BYTES) != 0)
+	throw std::bad_alloc();
+    free(batch->data);
+    batch->data = (uint8_t *)data;
+    batch->capacity = count;
+}
+
+uint8_t *key_crop(const key_batch *batch, int i)
+{
+    return(batch->data + (size_t)i * KEY_INPUT_BYTES);
+}
+
+/*
+  crops every key out of a bgr frame into the batch, crop i is keys[i]. keys that fall off the
+  frame are clipped to it, and one entirely off it gets an all black crop so the rest keep their
+  places.
+ */
+void pack_key_crops(const Mat &frame, const vector<Rect> &keys, key_batch *batch)
+{
+    CV_Assert(frame.type() == CV_8UC3);
+    reserve_key_batch(batch, keys.size());
+    batch->count = keys.size();
+    Rect frame_rect(0, 0, frame.cols, frame.rows);
+    for(int i = 0; i < batch->count; i++)
+    {
+	Mat slot(KEY_INPUT_SIZE, KEY_INPUT_SIZE, CV_8UC3, key_crop(batch, i));
+	Rect r = keys[i] & frame_rect;
+	if(r.area() == 0)
+	    slot.setTo(Scalar::all(0));
+	else
+	    resize(frame(r), slot, slot.size(), 0, 0, INTER_AREA);
+    }
+}
 
+#ifdef KEYBOARD_USE_TENSORFLOW
+//the training set as one N x H x W x 3 uint8 tensor, every image has to be the same size
 TF_Tensor *fill_input_tensor(const vector<Mat> &training_set)
 {
-    int64_t input_dims[3];
-    input_dims[0] = training_set[0].rows, input_dims[1] = training_set[0].cols, input_dims[2] = 3;
-    TF_Tensor *input = uint8_tensor(input_dims, 3, training_set.size());
+    int64_t input_dims[4];
+    input_dims[0] = training_set.size();
+    input_dims[1] = training_set[0].rows;
+    input_dims[2] = training_set[0].cols;
+    input_dims[3] = 3;
+    uint64_t image_bytes = input_dims[1] * input_dims[2] * input_dims[3];
+    TF_Tensor *input = uint8_tensor(input_dims, 4);
 
-    int64_t bytes_per_channel = training_set[0].rows * training_set[0].cols;
     uint8_t *data = (uint8_t *)TF_TensorData(input);
     for(int i = 0; i < training_set.size(); i++)
     {
-	Mat bgr[3];
-	split(training_set[i], bgr);
-	for(int j = 0; j < 3; j++)
-	{
-	    if(bgr[j].isContinuous())
-	    {
-		memcpy(data, bgr[j].ptr(0), bgr[j].rows * bgr[j].cols);
-		data += bytes_per_channel;
-	    }
-	    else
-	    {
-		for(int k = 0; k < bgr[j].cols; k++)
-		{
-		    memcpy(data, bgr[j].ptr(k), bgr[j].rows);
-		    data += bgr[j].rows;
-		}
-	    }
-	}
+	CV_Assert(training_set[i].type() == CV_8UC3 && training_set[i].size() == training_set[0].size());
+	pack_image(training_set[i], data + i * image_bytes);
     }
     return(input);
 }
+#endif
@@ -0,0 +1,241 @@
+#define KEYBOARD_TRACKER_NO_MAIN
+#include "keyboard_tracker.cpp"
+#include <chrono>
+#include <thread>
+#include <atomic>
+
+//./param_sweep /mnt/c/Users/Sasha/Downloads/keyboards/
+//./param_sweep /mnt/c/Users/Sasha/Downloads/keyboards/ 4 > sweep.txt
+
+/*
+  runs the contour tracker over every canny threshold and blur size in the grid below on a set
+  of labelled images, on all cores, and prints the settings ranked by how well they find the keys.
+  every image keyboard.png in the directory needs a keyboard.yml next to it with the true keys:
+    %YAML:1.0
+    keys: [ x, y, width, height, x, y, width, height, ... ]
+  a detection counts if it overlaps a labelled key with IoU >= SWEEP_MATCH_IOU, each key can only
+  be matched once.
+  the work is split into (image, blur size) jobs: a job blurs its image once and then runs every
+  canny threshold on that same blurred image, and the gray conversion is done once per image up
+  front. the time reported per image is what the tracker would take live with those settings,
+  blur included.
+  blur_std isn't swept, the gaussian blur it's for is commented out of keyboard_gray.
+ */
+#define SWEEP_MATCH_IOU 0.5f
+#define SWEEP_THRESH_MIN 10
+#define SWEEP_THRESH_MAX 150
+#define SWEEP_THRESH_STEP 10
+#define SWEEP_BLUR_MAX 5
+
+struct labelled_image
+{
+    String name;
+    Mat gray;
+    vector<Rect> keys;
+};
+
+struct sweep_score
+{
+    int true_positives;
+    int false_positives;
+    int false_negatives;
+    double ms;
+};
+
+struct sweep_result
+{
+    int blur_size;
+    int canny_thresh;
+    sweep_score total;
+    float precision;
+    float recall;
+    float f1;
+};
+
+bool load_labelled_images(const char *dir, vector<labelled_image> &images)
+{
+    vector<String> files;
+    glob(String(dir) + "/*", files);
+    for(const String &file : files)
+    {
+	size_t dot = file.find_last_of('.');
+	if(dot == String::npos || file.substr(dot) == ".yml")
+	    continue;
+	Mat image = imread(file, 1);
+	if(!image.data)
+	    continue;
+
+	FileStorage labels(file.substr(0, dot) + ".yml", FileStorage::READ);
+	if(!labels.isOpened())
+	{
+	    fprintf(stderr, "no labels for %s, skipping it\n", file.c_str());
+	    continue;
+	}
+	vector<int> values;
+	labels["keys"] >> values;
+
+	labelled_image l;
+	l.name = file;
+	cvtColor(image, l.gray, COLOR_BGR2GRAY);
+	for(int i = 0; i + 3 < (int)values.size(); i += 4)
+	    l.keys.push_back(Rect(values[i], values[i + 1], values[i + 2], values[i + 3]));
+	images.push_back(l);
+    }
+    return(!images.empty());
+}
+
+float rect_iou(const Rect &a, const Rect &b)
+{
+    int intersection = (a & b).area();
+    int union_area = a.area() + b.area() - intersection;
+    return(union_area > 0 ? (float)intersection / union_area : 0.0f);
+}
+
+//greedy: each detection takes the best unmatched key it overlaps enough
+void score_keys(const vector<Rect> &found, const vector<Rect> &keys, sweep_score *score)
+{
+    vector<bool> matched(keys.size(), false);
+    for(const Rect &f : found)
+    {
+	int best = -1;
+	float best_iou = SWEEP_MATCH_IOU;
+	for(int i = 0; i < (int)keys.size(); i++)
+	{
+	    float iou = rect_iou(f, keys[i]);
+	    if(!matched[i] && iou >= best_iou)
+	    {
+		best = i;
+		best_iou = iou;
+	    }
+	}
+	if(best < 0)
+	    score->false_positives++;
+	else
+	{
+	    matched[best] = true;
+	    score->true_positives++;
+	}
+    }
+    for(bool m : matched)
+	score->false_negatives += !m;
+}
+
+int threshold_count()
+{
+    return((SWEEP_THRESH_MAX - SWEEP_THRESH_MIN) / SWEEP_THRESH_STEP + 1);
+}
+
+/*
+  scores[(blur_size * threshold_count() + t) * images + image], every job writes its own slots
+  so the workers never share anything but the job counter.
+ */
+void sweep_worker(const vector<labelled_image> *images, std::atomic<int> *next_job, vector<sweep_score> *scores)
+{
+    KeyboardTracker tracker;
+    keyboard_workspace *ws = &tracker.ws;
+    int thresholds = threshold_count();
+    int jobs = images->size() * (SWEEP_BLUR_MAX + 1);
+    for(int job = (*next_job)++; job < jobs; job = (*next_job)++)
+    {
+	int image = job % images->size();
+	int blur_size = job / images->size();
+	const labelled_image &l = (*images)[image];
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int real_blur_size = 2 * blur_size + 1;
+	blur(l.gray, ws->gray, Size(real_blur_size, real_blur_size));
+	double blur_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	for(int t = 0; t < thresholds; t++)
+	{
+	    int canny_thresh = SWEEP_THRESH_MIN + t * SWEEP_THRESH_STEP;
+	    start = std::chrono::steady_clock::now();
+	    keyboard_edges(ws, ws->gray, canny_thresh);
+	    keyboard_mask(ws);
+	    keyboard_keys(ws, l.gray.size());
+	    const vector<Rect> &found = keyboard_score(ws, ws->gray);
+	    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	    sweep_score &score = (*scores)[(blur_size * thresholds + t) * images->size() + image];
+	    score_keys(found, l.keys, &score);
+	    score.ms = blur_ms + ms;
+	}
+    }
+}
+
+bool better_result(const sweep_result &a, const sweep_result &b)
+{
+    if(a.f1 != b.f1)
+	return(a.f1 > b.f1);
+    return(a.total.ms < b.total.ms);
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+	fprintf(stderr, "usage: %s <labelled image directory> [threads]\n", argv[0]);
+	return(-1);
+    }
+    int threads = argc >= 3 ? atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+    threads = std::max(threads, 1);
+
+    vector<labelled_image> images;
+    if(!load_labelled_images(argv[1], images))
+    {
+	fprintf(stderr, "couldn't find any labelled images in %s\n", argv[1]);
+	return(-1);
+    }
+
+    //every worker runs its own tracker, opencv's own threads would just fight them
+    setNumThreads(1);
+    int thresholds = threshold_count();
+    sweep_score zero = { 0, 0, 0, 0.0 };
+    vector<sweep_score> scores((SWEEP_BLUR_MAX + 1) * thresholds * images.size(), zero);
+    std::atomic<int> next_job(0);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    vector<std::thread> workers;
+    for(int i = 0; i < threads; i++)
+	workers.push_back(std::thread(sweep_worker, &images, &next_job, &scores));
+    for(std::thread &w : workers)
+	w.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    vector<sweep_result> results;
+    for(int blur_size = 0; blur_size <= SWEEP_BLUR_MAX; blur_size++)
+    {
+	for(int t = 0; t < thresholds; t++)
+	{
+	    sweep_result r;
+	    r.blur_size = blur_size;
+	    r.canny_thresh = SWEEP_THRESH_MIN + t * SWEEP_THRESH_STEP;
+	    r.total = zero;
+	    for(int i = 0; i < (int)images.size(); i++)
+	    {
+		const sweep_score &s = scores[(blur_size * thresholds + t) * images.size() + i];
+		r.total.true_positives += s.true_positives;
+		r.total.false_positives += s.false_positives;
+		r.total.false_negatives += s.false_negatives;
+		r.total.ms += s.ms;
+	    }
+	    r.total.ms /= images.size();
+	    int tp = r.total.true_positives;
+	    r.precision = tp ? (float)tp / (tp + r.total.false_positives) : 0.0f;
+	    r.recall = tp ? (float)tp / (tp + r.total.false_negatives) : 0.0f;
+	    r.f1 = tp ? 2.0f * r.precision * r.recall / (r.precision + r.recall) : 0.0f;
+	    results.push_back(r);
+	}
+    }
+    std::sort(results.begin(), results.end(), better_result);
+
+    printf("%lu images, %lu settings, %d threads, %.2fs\n", images.size(), results.size(), threads, seconds);
+    printf("%4s %9s %12s %9s %9s %9s %12s\n", "rank", "blur size", "canny thresh", "precision", "recall", "f1", "ms/image");
+    for(int i = 0; i < (int)results.size(); i++)
+    {
+	const sweep_result &r = results[i];
+	printf("%4d %9d %12d %9.3f %9.3f %9.3f %12.3f\n", i + 1, r.blur_size, r.canny_thresh,
+	       r.precision, r.recall, r.f1, r.total.ms);
+    }
+    return(0);
+}
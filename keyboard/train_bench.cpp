@@ -0,0 +1,71 @@
+#include "trainer.cpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+//./train_bench
+//./train_bench 8 128
+//./train_bench 8 128 50
+//./train_bench 8 128 50 im2col
+
+/*
+  trains the cnn_model shaped network on a batch of random 28x28 crops with random labels for
+  a number of steps (after one to warm up) and prints samples/s for 1, 2, 4, ... threads up to
+  the number given (the core count by default), and the speedup over one thread, with the
+  convolutions run by the backend named (conv_backend.cpp, winograd by default). every run
+  starts from the same weights, so the loss at the end should come out nearly the same for any
+  thread count, only the order the gradients are added in changes.
+ */
+#define BENCH_SIZE 28
+#define BENCH_CLASSES 62
+
+int main(int argc, char** argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+    int batch = argc > 2 ? atoi(argv[2]) : 64;
+    int steps = argc > 3 ? atoi(argv[3]) : 20;
+    int backend = argc > 4 ? conv_backend_by_name(argv[4]) : default_trainer_params().conv_backend;
+    if(backend < 0)
+    {
+	fprintf(stderr, "no convolution backend %s, there's rows, im2col and winograd\n", argv[4]);
+	return(-1);
+    }
+    std::mt19937 rng(1234);
+    std::vector<float> inputs((size_t)batch * BENCH_SIZE * BENCH_SIZE * 3);
+    std::uniform_real_distribution<float> pixel(0.0f, 1.0f);
+    for(float &v : inputs)
+	v = pixel(rng);
+    std::vector<int32_t> labels(batch);
+    for(int32_t &label : labels)
+	label = rng() % BENCH_CLASSES;
+
+    printf("%s convolutions\n", conv_backend_names[backend]);
+    double single = 0.0;
+    for(int threads = 1; ; threads = std::min(threads * 2, max_threads))
+    {
+	key_classifier model;
+	random_key_classifier(&model, BENCH_SIZE, BENCH_CLASSES, 1);
+	trainer_params params = default_trainer_params();
+	params.threads = threads;
+	params.conv_backend = backend;
+	trainer t;
+	start_trainer(&t, &model, params);
+	train_step(&t, inputs.data(), labels.data(), batch);
+
+	float loss = 0.0f;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(int i = 0; i < steps; i++)
+	    loss = train_step(&t, inputs.data(), labels.data(), batch);
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	stop_trainer(&t);
+
+	double rate = steps * batch / elapsed;
+	if(threads == 1)
+	    single = rate;
+	printf("%2d threads: %7.1f samples/s, %6.2f ms per batch of %d, %.2fx, loss %.4f\n",
+	       threads, rate, elapsed * 1e3 / steps, batch, rate / single, loss);
+	if(threads == max_threads)
+	    break;
+    }
+    return(0);
+}
@@ -0,0 +1,82 @@
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include "neural_net.cpp"
+#include "batch_loader.cpp"
+#include "trainer.cpp"
+
+//./train_keys
+//./train_keys keys.kdat keys.kcnn
+//./train_keys keys.kdat keys.kcnn 5
+
+/*
+  keys.kdat comes from ./make_dataset data.yml keys.kdat, the images in it are already decoded.
+  trains a cnn_model shaped network on its train split with the trainer's threads, the next
+  batch shuffled, randomly distorted and converted to floats by the loader's threads while this
+  one trains, and writes it to keys.kcnn, which is what key_classifier.cpp (and so the tracker)
+  loads.
+ */
+#define TRAIN_EPOCHS 20
+
+int main(int argc, char** argv)
+{
+    const char *dataset = argc > 1 ? argv[1] : "keys.kdat";
+    const char *weights = argc > 2 ? argv[2] : "keys.kcnn";
+    int epochs = argc > 3 ? atoi(argv[3]) : TRAIN_EPOCHS;
+
+    key_dataset ds;
+    if(!open_key_dataset(dataset, &ds))
+	return(-1);
+    //open_key_dataset has already turned away negative labels, so the largest one sets the class count
+    int classes = 0;
+    for(int i = 0; i < ds.header->count; i++)
+	classes = std::max(classes, ds.labels[i] + 1);
+
+    batch_loader_params params = default_batch_loader_params();
+    params.augment.enabled = true;
+    if(ds.header->train_count < params.batch_size)
+    {
+	fprintf(stderr, "%s has %d training images, a batch needs %d\n", dataset, ds.header->train_count,
+		params.batch_size);
+	close_key_dataset(&ds);
+	return(-1);
+    }
+    batch_loader loader;
+    start_batch_loader(&loader, dataset_source(&ds), ds.train, ds.header->train_count, params);
+
+    key_classifier model;
+    random_key_classifier(&model, params.image_size, classes, params.seed);
+    trainer t;
+    start_trainer(&t, &model, default_trainer_params());
+    printf("%s: %d training images, %d classes, %d batches of %d per epoch\n", dataset, ds.header->train_count,
+	   classes, loader.batches_per_epoch, params.batch_size);
+    for(int epoch = 0; epoch < epochs; epoch++)
+    {
+	double loss = 0.0;
+	int correct = 0;
+	for(int i = 0; i < loader.batches_per_epoch; i++)
+	{
+	    const loader_batch *batch = next_batch(&loader);
+	    int right;
+	    float batch_loss = train_step(&t, batch->data.data(), batch->labels.data(), params.batch_size, &right);
+	    release_batch(&loader);
+	    if(batch_loss < 0.0f)
+	    {
+		stop_trainer(&t);
+		stop_batch_loader(&loader);
+		close_key_dataset(&ds);
+		return(-1);
+	    }
+	    loss += batch_loss;
+	    correct += right;
+	}
+	printf("epoch %d: loss %.4f, %.1f%% right\n", epoch, loss / loader.batches_per_epoch,
+	       100.0 * correct / (loader.batches_per_epoch * params.batch_size));
+    }
+    stop_trainer(&t);
+    print_loader_stats(&loader, stdout);
+    stop_batch_loader(&loader);
+    close_key_dataset(&ds);
+    return(save_key_classifier(weights, &model) ? 0 : -1);
+}
@@ -0,0 +1,536 @@
+#ifndef TRAINER_CPP
+#define TRAINER_CPP
+#include <stdint.h>
+#include <assert.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include "key_classifier.cpp"
+#include "gemm.cpp"
+#include "conv_backend.cpp"
+
+/*
+  mini-batch training for the key classifier's networks (conv, relu, max pool, dense, and a
+  softmax last with cross entropy loss), so what's trained is exactly what key_classifier.cpp
+  runs and save_key_classifier writes it for the tracker.
+
+  a step splits the batch into one slice per thread. each thread runs the forward and backward
+  passes over its own slice and sums the gradients into its own buffer, so nothing is shared
+  while the real work happens. then every thread takes one stretch of the (flattened) parameters,
+  adds that stretch up over all the threads' buffers, zeroes it behind it and applies the sgd with
+  momentum or adam update to it. no two threads ever touch the same float in either phase, so the
+  only synchronization is the pool waiting for both phases to finish.
+
+  the input is count images of input_size x input_size x input_channels floats, NHWC, which is
+  what batch_loader hands out. params.conv_backend picks how the convolutions run (conv_backend.cpp),
+  they all give the same gradients up to rounding.
+ */
+enum { OPTIMIZER_SGD, OPTIMIZER_ADAM };
+
+struct trainer_params
+{
+    int threads;
+    int optimizer;
+    float learning_rate;
+    float momentum;
+    float beta1;
+    float beta2;
+    float epsilon;
+    float weight_decay;
+    int conv_backend;
+};
+
+trainer_params default_trainer_params()
+{
+    trainer_params params;
+    params.threads = std::max(1u, std::thread::hardware_concurrency());
+    params.optimizer = OPTIMIZER_ADAM;
+    params.learning_rate = 0.001f;
+    params.momentum = 0.9f;
+    params.beta1 = 0.9f;
+    params.beta2 = 0.999f;
+    params.epsilon = 1e-8f;
+    params.weight_decay = 0.0f;
+    params.conv_backend = CONV_WINOGRAD;
+    return(params);
+}
+
+//one weight or bias array, where it sits in the flattened parameters
+struct parameter_block
+{
+    float *values;
+    size_t count;
+    size_t offset;
+    bool decay;
+};
+
+//everything one thread needs for its slice, sized for the biggest slice it has seen
+struct trainer_thread
+{
+    std::vector<std::vector<float> > activations;
+    std::vector<std::vector<int32_t> > pool_index;
+    std::vector<float> delta;
+    std::vector<float> next_delta;
+    std::vector<float> transposed;
+    std::vector<float> gradients;
+    gemm_workspace gemm;
+    conv_workspace conv;
+    double loss;
+    int correct;
+};
+
+struct trainer
+{
+    key_classifier *model;
+    trainer_params params;
+    std::vector<parameter_block> blocks;
+    size_t parameter_count;
+    std::vector<float> first_moment;
+    std::vector<float> second_moment;
+    //dense weights as [out][in] for the input gradient, and the conv weights as the backend
+    //wants them, redone once per step
+    std::vector<std::vector<float> > transposed_weights;
+    std::vector<conv_weights> prepared;
+    std::vector<trainer_thread> threads;
+    int64_t steps;
+    gemm_micro_kernel micro;
+
+    std::vector<std::thread> pool;
+    std::function<void(int)> job;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    int64_t generation;
+    int running;
+    bool stop;
+};
+
+void trainer_worker(trainer *t, int id)
+{
+    int64_t seen = 0;
+    std::unique_lock<std::mutex> guard(t->lock);
+    while(true)
+    {
+	t->wake.wait(guard, [&]() { return(t->stop || t->generation != seen); });
+	if(t->stop)
+	    return;
+	seen = t->generation;
+	guard.unlock();
+	t->job(id);
+	guard.lock();
+	if(--t->running == 0)
+	    t->finished.notify_one();
+    }
+}
+
+//runs job(0) .. job(threads - 1) at once, job(0) on the calling thread, and waits for all of them
+void run_on_threads(trainer *t, const std::function<void(int)> &job)
+{
+    {
+	std::lock_guard<std::mutex> guard(t->lock);
+	t->job = job;
+	t->running = t->params.threads - 1;
+	t->generation++;
+    }
+    t->wake.notify_all();
+    job(0);
+    std::unique_lock<std::mutex> guard(t->lock);
+    t->finished.wait(guard, [&]() { return(t->running == 0); });
+}
+
+void start_trainer(trainer *t, key_classifier *model, trainer_params params)
+{
+    assert(params.threads > 0 && !model->layers.empty() && model->layers.back().type == LAYER_SOFTMAX);
+    t->model = model;
+    t->params = params;
+    t->blocks.clear();
+    t->parameter_count = 0;
+    for(cnn_layer &l : model->layers)
+    {
+	if(l.type != LAYER_CONV && l.type != LAYER_DENSE)
+	    continue;
+	parameter_block weights = { l.weights.data(), l.weights.size(), t->parameter_count, true };
+	t->parameter_count += l.weights.size();
+	parameter_block bias = { l.bias.data(), l.bias.size(), t->parameter_count, false };
+	t->parameter_count += l.bias.size();
+	t->blocks.push_back(weights);
+	t->blocks.push_back(bias);
+    }
+    t->first_moment.assign(t->parameter_count, 0.0f);
+    t->second_moment.assign(params.optimizer == OPTIMIZER_ADAM ? t->parameter_count : 0, 0.0f);
+    t->transposed_weights.assign(model->layers.size(), std::vector<float>());
+    t->prepared.assign(model->layers.size(), conv_weights());
+    t->threads.assign(params.threads, trainer_thread());
+    for(trainer_thread &thread : t->threads)
+    {
+	thread.activations.assign(model->layers.size() + 1, std::vector<float>());
+	thread.pool_index.assign(model->layers.size(), std::vector<int32_t>());
+	thread.gradients.assign(t->parameter_count, 0.0f);
+    }
+    t->steps = 0;
+    t->micro = best_gemm_micro_kernel();
+    t->generation = 0;
+    t->running = 0;
+    t->stop = false;
+    for(int i = 1; i < params.threads; i++)
+	t->pool.push_back(std::thread(trainer_worker, t, i));
+}
+
+void stop_trainer(trainer *t)
+{
+    {
+	std::lock_guard<std::mutex> guard(t->lock);
+	t->stop = true;
+    }
+    t->wake.notify_all();
+    for(std::thread &worker : t->pool)
+	worker.join();
+    t->pool.clear();
+}
+
+//max pooling that remembers where each maximum came from, for the backward pass
+void max_pool_indexed(const float *image, int size, int channels, int pool, float *out, int32_t *index)
+{
+    int out_size = size / pool;
+    for(int y = 0; y < out_size; y++)
+    {
+	for(int x = 0; x < out_size; x++)
+	{
+	    size_t o = ((size_t)y * out_size + x) * channels;
+	    for(int c = 0; c < channels; c++)
+	    {
+		int32_t best = ((y * pool) * size + x * pool) * channels + c;
+		for(int py = 0; py < pool; py++)
+		{
+		    for(int px = 0; px < pool; px++)
+		    {
+			int32_t i = ((y * pool + py) * size + x * pool + px) * channels + c;
+			if(image[i] > image[best])
+			    best = i;
+		    }
+		}
+		out[o + c] = image[best];
+		index[o + c] = best;
+	    }
+	}
+    }
+}
+
+//forward over count images, keeping every layer's output in thread->activations
+void forward_slice(trainer *t, trainer_thread *thread, const float *input, int count)
+{
+    const key_classifier *model = t->model;
+    int size = model->input_size;
+    int channels = model->input_channels;
+    size_t per_image = (size_t)size * size * channels;
+    thread->activations[0].assign(input, input + per_image * count);
+    for(size_t i = 0; i < model->layers.size(); i++)
+    {
+	const cnn_layer &l = model->layers[i];
+	const std::vector<float> &in = thread->activations[i];
+	std::vector<float> &out = thread->activations[i + 1];
+	switch(l.type)
+	{
+	case LAYER_CONV:
+	    out.resize((size_t)size * size * l.out_channels * count);
+	    conv_forward(t->params.conv_backend, &l, &t->prepared[i], in.data(), count, size, out.data(),
+			 &thread->conv, t->micro);
+	    channels = l.out_channels;
+	    break;
+	case LAYER_RELU:
+	    out.resize(in.size());
+	    for(size_t j = 0; j < in.size(); j++)
+		out[j] = std::max(in[j], 0.0f);
+	    break;
+	case LAYER_MAXPOOL:
+	{
+	    int out_size = size / l.pool;
+	    size_t out_image = (size_t)out_size * out_size * channels;
+	    out.resize(out_image * count);
+	    thread->pool_index[i].resize(out_image * count);
+	    for(int n = 0; n < count; n++)
+		max_pool_indexed(in.data() + n * per_image, size, channels, l.pool, out.data() + n * out_image,
+				 thread->pool_index[i].data() + n * out_image);
+	    size = out_size;
+	    break;
+	}
+	case LAYER_DENSE:
+	    out.resize((size_t)l.out_channels * count);
+	    fill_bias(out.data(), l.bias.data(), count, l.out_channels);
+	    sgemm(count, l.out_channels, l.in_channels, in.data(), l.in_channels, l.weights.data(), l.out_channels,
+		  out.data(), l.out_channels, true, &thread->gemm, t->micro);
+	    size = 1;
+	    channels = l.out_channels;
+	    break;
+	case LAYER_SOFTMAX:
+	    out = in;
+	    for(int n = 0; n < count; n++)
+		softmax(out.data() + n * per_image, per_image);
+	    break;
+	}
+	per_image = (size_t)size * size * channels;
+    }
+}
+
+/*
+  backward over the slice, from the softmax's (p - onehot) / batch down to the first layer,
+  adding each layer's gradients into the thread's own buffer. dividing by the whole batch here
+  means the threads' buffers just add up to the batch's mean gradient.
+ */
+void backward_slice(trainer *t, trainer_thread *thread, const int32_t *labels, int count, int batch)
+{
+    const key_classifier *model = t->model;
+    int layers = model->layers.size();
+    int classes = classifier_outputs(model);
+    const std::vector<float> &probabilities = thread->activations[layers];
+    std::vector<float> &delta = thread->delta;
+    delta.assign(probabilities.begin(), probabilities.end());
+    thread->loss = 0.0;
+    thread->correct = 0;
+    for(int n = 0; n < count; n++)
+    {
+	const float *p = probabilities.data() + (size_t)n * classes;
+	thread->loss -= log(std::max(p[labels[n]], 1e-12f));
+	thread->correct += std::max_element(p, p + classes) - p == labels[n];
+	delta[(size_t)n * classes + labels[n]] -= 1.0f;
+    }
+    for(float &d : delta)
+	d /= batch;
+
+    //the shape coming into each layer, walked forwards once so the loop below can go backwards
+    std::vector<int> sizes(layers + 1), channel_counts(layers + 1);
+    sizes[0] = model->input_size;
+    channel_counts[0] = model->input_channels;
+    for(int i = 0; i < layers; i++)
+    {
+	const cnn_layer &l = model->layers[i];
+	sizes[i + 1] = l.type == LAYER_MAXPOOL ? sizes[i] / l.pool : l.type == LAYER_DENSE ? 1 : sizes[i];
+	channel_counts[i + 1] = l.type == LAYER_CONV || l.type == LAYER_DENSE ? l.out_channels : channel_counts[i];
+    }
+
+    size_t block = t->blocks.size();
+    for(int i = layers - 2; i >= 0; i--)
+    {
+	const cnn_layer &l = model->layers[i];
+	const std::vector<float> &in = thread->activations[i];
+	int size = sizes[i];
+	int channels = channel_counts[i];
+	size_t per_image = (size_t)size * size * channels;
+	bool need_input = i > 0;
+	std::vector<float> &next = thread->next_delta;
+	switch(l.type)
+	{
+	case LAYER_CONV:
+	{
+	    block -= 2;
+	    float *dw = thread->gradients.data() + t->blocks[block].offset;
+	    float *db = thread->gradients.data() + t->blocks[block + 1].offset;
+	    next.resize(need_input ? per_image * count : 0);
+	    conv_backward(t->params.conv_backend, &l, &t->prepared[i], in.data(), delta.data(), count, size, dw, db,
+			  need_input ? next.data() : nullptr, &thread->conv, t->micro);
+	    break;
+	}
+	case LAYER_RELU:
+	{
+	    const std::vector<float> &out = thread->activations[i + 1];
+	    next.resize(delta.size());
+	    for(size_t j = 0; j < delta.size(); j++)
+		next[j] = out[j] > 0.0f ? delta[j] : 0.0f;
+	    break;
+	}
+	case LAYER_MAXPOOL:
+	{
+	    const std::vector<int32_t> &index = thread->pool_index[i];
+	    size_t out_image = delta.size() / count;
+	    next.assign(per_image * count, 0.0f);
+	    for(int n = 0; n < count; n++)
+		for(size_t j = 0; j < out_image; j++)
+		    next[n * per_image + index[n * out_image + j]] += delta[n * out_image + j];
+	    break;
+	}
+	case LAYER_DENSE:
+	{
+	    block -= 2;
+	    float *dw = thread->gradients.data() + t->blocks[block].offset;
+	    float *db = thread->gradients.data() + t->blocks[block + 1].offset;
+	    //dw[in][out] += in^T * delta, db += the column sums of delta, next = delta * w^T
+	    thread->transposed.resize((size_t)l.in_channels * count);
+	    transpose_blocked(in.data(), count, l.in_channels, thread->transposed.data());
+	    sgemm(l.in_channels, l.out_channels, count, thread->transposed.data(), count, delta.data(), l.out_channels,
+		  dw, l.out_channels, true, &thread->gemm, t->micro);
+	    for(int n = 0; n < count; n++)
+		for(int o = 0; o < l.out_channels; o++)
+		    db[o] += delta[(size_t)n * l.out_channels + o];
+	    if(need_input)
+	    {
+		next.resize((size_t)count * l.in_channels);
+		sgemm(count, l.in_channels, l.out_channels, delta.data(), l.out_channels,
+		      t->transposed_weights[i].data(), l.in_channels, next.data(), l.in_channels,
+		      false, &thread->gemm, t->micro);
+	    }
+	    break;
+	}
+	case LAYER_SOFTMAX:
+	    assert(!"softmax only goes last");
+	    break;
+	}
+	delta.swap(next);
+    }
+}
+
+//sums stretch [begin, end) of every thread's gradients, zeroes them, and updates those parameters
+void update_parameters(trainer *t, size_t begin, size_t end)
+{
+    const trainer_params &p = t->params;
+    float correction1 = 1.0f - powf(p.beta1, (float)t->steps);
+    float correction2 = 1.0f - powf(p.beta2, (float)t->steps);
+    for(const parameter_block &b : t->blocks)
+    {
+	size_t from = std::max(begin, b.offset);
+	size_t to = std::min(end, b.offset + b.count);
+	for(size_t j = from; j < to; j++)
+	{
+	    float g = 0.0f;
+	    for(trainer_thread &thread : t->threads)
+	    {
+		g += thread.gradients[j];
+		thread.gradients[j] = 0.0f;
+	    }
+	    float &w = b.values[j - b.offset];
+	    if(b.decay)
+		g += p.weight_decay * w;
+	    if(p.optimizer == OPTIMIZER_ADAM)
+	    {
+		float &m = t->first_moment[j];
+		float &v = t->second_moment[j];
+		m = p.beta1 * m + (1.0f - p.beta1) * g;
+		v = p.beta2 * v + (1.0f - p.beta2) * g * g;
+		w -= p.learning_rate * (m / correction1) / (sqrtf(v / correction2) + p.epsilon);
+	    }
+	    else
+	    {
+		float &v = t->first_moment[j];
+		v = p.momentum * v + g;
+		w -= p.learning_rate * v;
+	    }
+	}
+    }
+}
+
+//the weights as the backward pass (and the winograd forward pass) want them, once per step since the update changes them
+void prepare_layer_weights(trainer *t)
+{
+    const key_classifier *model = t->model;
+    for(size_t i = 0; i < model->layers.size(); i++)
+    {
+	const cnn_layer &l = model->layers[i];
+	if(l.type == LAYER_CONV)
+	    prepare_conv_weights(t->params.conv_backend, &l, &t->prepared[i]);
+	if(l.type != LAYER_DENSE || i == 0)
+	    continue;
+	t->transposed_weights[i].resize(l.weights.size());
+	transpose_blocked(l.weights.data(), l.in_channels, l.out_channels, t->transposed_weights[i].data());
+    }
+}
+
+/*
+  one step of training on count images and their labels (0 based classes).
+  returns the batch's mean cross entropy, and how many it got right before the update in correct.
+  a label that isn't one of the classifier's classes would index past its outputs, so the batch
+  is turned down without training and -1 comes back.
+ */
+float train_step(trainer *t, const float *inputs, const int32_t *labels, int count, int *correct = nullptr)
+{
+    const key_classifier *model = t->model;
+    int classes = classifier_outputs(model);
+    for(int i = 0; i < count; i++)
+    {
+	if(labels[i] < 0 || labels[i] >= classes)
+	{
+	    fprintf(stderr, "label %d of image %d isn't one of the classifier's %d classes\n", labels[i], i,
+		    classes);
+	    if(correct)
+		*correct = 0;
+	    return(-1.0f);
+	}
+    }
+    prepare_layer_weights(t);
+    size_t per_image = (size_t)model->input_size * model->input_size * model->input_channels;
+    int threads = t->params.threads;
+    t->steps++;
+    run_on_threads(t, [&](int id) {
+	    int begin = (int)((int64_t)count * id / threads);
+	    int end = (int)((int64_t)count * (id + 1) / threads);
+	    trainer_thread *thread = &t->threads[id];
+	    thread->loss = 0.0;
+	    thread->correct = 0;
+	    if(end == begin)
+		return;
+	    forward_slice(t, thread, inputs + begin * per_image, end - begin);
+	    backward_slice(t, thread, labels + begin, end - begin, count);
+	});
+    run_on_threads(t, [&](int id) {
+	    update_parameters(t, t->parameter_count * id / threads, t->parameter_count * (id + 1) / threads);
+	});
+
+    double loss = 0.0;
+    int right = 0;
+    for(const trainer_thread &thread : t->threads)
+    {
+	loss += thread.loss;
+	right += thread.correct;
+    }
+    if(correct)
+	*correct = right;
+    return((float)(loss / count));
+}
+
+//appends a layer, conv and dense ones he initialized with zero biases
+void add_layer(key_classifier *model, int type, int in, int out, int kernel, int pool, std::mt19937 &rng)
+{
+    cnn_layer l;
+    l.type = type;
+    l.in_channels = in;
+    l.out_channels = out;
+    l.kernel = kernel;
+    l.pool = pool;
+    if(type == LAYER_CONV || type == LAYER_DENSE)
+    {
+	int fan_in = in * kernel * kernel;
+	std::normal_distribution<float> dist(0.0f, sqrtf(2.0f / fan_in));
+	l.weights.resize((size_t)fan_in * out);
+	for(float &w : l.weights)
+	    w = dist(rng);
+	l.bias.assign(out, 0.0f);
+    }
+    model->layers.push_back(l);
+}
+
+/*
+  an untrained model in the shape cnn_model was building: conv 5x5x32, relu, pool, conv 5x5x64,
+  relu, pool, dense 128, relu, dense classes, softmax. size should be a multiple of 4.
+ */
+void random_key_classifier(key_classifier *model, int size, int classes, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    model->input_size = size;
+    model->input_channels = 3;
+    model->layers.clear();
+    int pooled = size / 4;
+    add_layer(model, LAYER_CONV, 3, 32, 5, 0, rng);
+    add_layer(model, LAYER_RELU, 0, 0, 0, 0, rng);
+    add_layer(model, LAYER_MAXPOOL, 0, 0, 0, 2, rng);
+    add_layer(model, LAYER_CONV, 32, 64, 5, 0, rng);
+    add_layer(model, LAYER_RELU, 0, 0, 0, 0, rng);
+    add_layer(model, LAYER_MAXPOOL, 0, 0, 0, 2, rng);
+    add_layer(model, LAYER_DENSE, pooled * pooled * 64, 128, 1, 0, rng);
+    add_layer(model, LAYER_RELU, 0, 0, 0, 0, rng);
+    add_layer(model, LAYER_DENSE, 128, classes, 1, 0, rng);
+    add_layer(model, LAYER_SOFTMAX, 0, 0, 0, 0, rng);
+}
+#endif
@@ -1,7 +1,20 @@
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/video/tracking.hpp"
 #include <iostream>
 #include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "spsc_queue.cpp"
+#include "hsv_threshold.cpp"
+#include "../common/rect_morphology.cpp"
+#include "../common/label_bounds.cpp"
+#include "../common/video_source.cpp"
 
 using namespace cv;
 //For compatibility with opencv2
@@ -11,6 +24,12 @@ namespace cv
 }
 
 //./cv_practice /mnt/c/Users/Sasha/Downloads/tennisball2.jpg
+//./cv_practice --stream 0 > detections.csv
+//./cv_practice --stream 0 --depth 2 > detections.csv
+//./cv_practice --stream 0 --track > detections.csv
+//./cv_practice --stream 0 --levels 2 > detections.csv
+//./cv_practice --pyramid-bench /mnt/c/Users/Sasha/Downloads/tennisball2.jpg 3
+//./cv_practice --stream /mnt/c/Users/Sasha/Downloads/tennisball.mp4
 
 Mat color_corrected(Mat img)
 {
@@ -31,41 +50,72 @@ Mat color_corrected(Mat img)
     return(corrected);
 }
 
-Mat threshold_image(Mat img)
+struct component_stats
 {
-    Mat hsv(img.rows, img.cols, CV_8UC3);
-    cvtColor(img, hsv, CV_BGR2HSV);
-    Mat thresh(img.rows, img.cols, CV_8UC1);
-    inRange(hsv, Scalar(0.11 * 256, 0.60 * 256, 0.20 * 256), Scalar(0.14 * 256, 1.0 * 255.0, 1.0 * 256), thresh);
-    return(thresh);
-}
+    Rect bounds;
+    int area;
+    float iou;
+};
 
-Mat morphed_img(Mat mask)
+/*
+  everything the filter touches from frame to frame. under continuous video the frame size doesn't
+  change, so after the first frame every Mat in here is already the right size and opencv writes
+  into it instead of allocating, and the same goes for the morphology's scratch buffers.
+  the morphology ping-pongs between thresh and morphed rather than working in place.
+  one of these per thread (or per frame in flight), they aren't meant to be shared.
+ */
+struct ball_workspace
 {
-    Mat se21 = getStructuringElement(MORPH_RECT, Size(21, 21));
-    Mat se11 = getStructuringElement(MORPH_RECT, Size(11, 11));
+    rect_morph_buffers morph;
+    Mat thresh;
+    Mat morphed;
+    Mat filtered;
+    Mat labels;
+    vector<Rect> bounds;
+    vector<int> areas;
+    vector<component_stats> components;
+    vector<Rect> balls;
+};
+
+Mat threshold_image(Mat img, ball_workspace *ws)
+{
+    yellow_mask(img, ws->thresh);
+    return(ws->thresh);
+}
 
-    morphologyEx(mask, mask, MORPH_CLOSE, se21);
-    morphologyEx(mask, mask, MORPH_OPEN, se11);
+//level is the pyramid level the image came from, the kernels shrink with it so they cover the same part of the scene
+Mat morphed_img(Mat mask, ball_workspace *ws, int level = 0)
+{
+    int close = std::max(21 >> level, 1);
+    int open = std::max(11 >> level, 1);
+    int blur = (15 >> level) | 1;
+    rect_morphology(mask, ws->morphed, MORPH_CLOSE, Size(close, close), &ws->morph);
+    rect_morphology(ws->morphed, ws->thresh, MORPH_OPEN, Size(open, open), &ws->morph);
 
-    GaussianBlur(mask, mask, Size(15, 15), 0, 0);
-    return(mask);   
+    GaussianBlur(ws->thresh, ws->filtered, Size(blur, blur), 0, 0);
+    return(ws->filtered);
 }
 
-Mat overall_filter(Mat img)
+Mat overall_filter(Mat img, ball_workspace *ws, int level = 0)
 {
 //    Mat corrected = color_corrected(img);
-    Mat mask = threshold_image(img);
-    Mat filtered = morphed_img(mask);
+    Mat mask = threshold_image(img, ws);
+    Mat filtered = morphed_img(mask, ws, level);
     return(filtered);
 }
 
+void hough_circles(Mat filtered, vector<Vec3f> &circles, int min_radius = 0, int max_radius = 0)
+{
+    HoughCircles(filtered, circles, CV_HOUGH_GRADIENT, 1.1, filtered.rows/10, 100, 40, min_radius, max_radius);
+}
+
 void hough_circles_identifier(Mat src)
 {
-    Mat hough_in = overall_filter(src);
+    ball_workspace ws;
+    Mat hough_in = overall_filter(src, &ws);
     vector<Vec3f> circles;
     /// Apply the Hough Transform to find the circles
-    HoughCircles(hough_in, circles, CV_HOUGH_GRADIENT, 1.1, hough_in.rows/10, 100, 40, 0, 0);
+    hough_circles(hough_in, circles);
 
     printf("circles: %lu\n", circles.size());
     /// Draw the circles detected
@@ -89,58 +139,851 @@ void hough_circles_identifier(Mat src)
   take the inscribed circle of the bounding square, then calculate a coverage overlap
   that will give you a "percent like a circle" metric
   and you can tune that threshold to whatever is best for your application
+
+  one pass over the label image gives us every bounding box and area, then for each component we
+  only walk the rows of its bounding box, and only the span of each row that lies inside the circle.
+  so the whole thing is linear in the frame size no matter how many blobs there are. the stats are
+  gathered by hand rather than with connectedComponentsWithStats so that they land in the
+  workspace's vector instead of a stats Mat that changes size (and gets reallocated) every frame.
  */
-void connected_components_identifier(Mat src)
+const vector<component_stats> &component_statistics(Mat filtered, ball_workspace *ws)
 {
-    Mat filtered = overall_filter(src);
-    Mat labels;
-    int components = connectedComponents(filtered, labels);
-    printf("%d connected components\n", components);
-    vector<Rect> rectangles;
+    Mat &labels = ws->labels;
+    int components = connectedComponents(filtered, labels, 8, CV_32S);
+
+    vector<component_stats> &result = ws->components;
+    label_bounds(labels, components, ws->bounds, &ws->areas);
+    result.resize(ws->bounds.size());
+
     for(int i = 1; i < components; i++)
     {
-	Mat component_i;
-	inRange(labels, Scalar(i), Scalar(i), component_i);
-	Rect r = boundingRect(component_i);
-	
-	Point center = (r.tl() + r.br()) / 2;
-	int radius = abs(r.tl().y - center.y);
-	Mat circ(component_i.size(), component_i.type());
-	circ = Scalar(0, 0, 0);
-	circle(circ, center, radius, i, -1);
+	component_stats &c = result[i - 1];
+	c.bounds = ws->bounds[i - 1];
+	c.area = ws->areas[i - 1];
 
-	Mat intersection;
-	bitwise_and(circ, component_i, intersection);
-	Mat union_;
-	bitwise_or(circ, component_i, union_);
+	Point center = (c.bounds.tl() + c.bounds.br()) / 2;
+	int radius = abs(c.bounds.tl().y - center.y);
 
-	printf("intersection: %d\n", countNonZero(intersection));
-	printf("union: %d\n", countNonZero(union_));
+	//the circle can poke out of the bounding box, so its area is clipped to the image
+	//but the intersection only ever has to look inside the box
+	int circle_area = 0;
+	int intersection = 0;
+	int top = std::max(center.y - radius, 0);
+	int bottom = std::min(center.y + radius, labels.rows - 1);
+	for(int y = top; y <= bottom; y++)
+	{
+	    int dy = y - center.y;
+	    int half = (int)sqrtf((float)(radius * radius - dy * dy));
+	    int left = std::max(center.x - half, 0);
+	    int right = std::min(center.x + half, labels.cols - 1);
+	    circle_area += right - left + 1;
 
-	float iou = (float)countNonZero(intersection) / (float)countNonZero(union_);
+	    if(y < c.bounds.y || y >= c.bounds.y + c.bounds.height)
+		continue;
+	    left = std::max(left, c.bounds.x);
+	    right = std::min(right, c.bounds.x + c.bounds.width - 1);
+	    const int *row = labels.ptr<int>(y);
+	    for(int x = left; x <= right; x++)
+		intersection += row[x] == i;
+	}
 
-	printf("%.3f iou\n", iou);
+	int union_ = c.area + circle_area - intersection;
+	c.iou = union_ > 0 ? (float)intersection / (float)union_ : 0.0f;
+    }
+    return(result);
+}
 
+const vector<Rect> &circular_components(Mat filtered, ball_workspace *ws)
+{
 #define CIRCLE_THRESH 0.8f
-
-	if(iou >= CIRCLE_THRESH)
-	    rectangles.push_back(r);
-
-#undef CIRCLE_THRESH
+    ws->balls.clear();
+    for(const component_stats &c : component_statistics(filtered, ws))
+    {
+	if(c.iou >= CIRCLE_THRESH)
+	    ws->balls.push_back(c.bounds);
     }
+    return(ws->balls);
+#undef CIRCLE_THRESH
+}
+
+void connected_components_identifier(Mat src)
+{
+    ball_workspace ws;
+    Mat filtered = overall_filter(src, &ws);
+    const vector<Rect> &rectangles = circular_components(filtered, &ws);
+    printf("%lu circular components\n", rectangles.size());
 
     for(Rect r : rectangles)
     {
 	rectangle(src, r.tl(), r.br(), Scalar(255, 0, 0), 1);
     }
-    
-    normalize(labels, labels, 0, 255, NORM_MINMAX, CV_8U);
+
     namedWindow("Connected Components Transform", CV_WINDOW_AUTOSIZE);
     imshow("Connected Components Transform", src);
 }
 
+/*
+  once we've seen the ball, it only moves a few pixels a frame, so there's no point filtering the
+  whole image. a constant velocity kalman filter predicts where the ball will be next and we only
+  threshold/morph/score a window around that, sized off the ball and how fast it's going, plus
+  enough margin that the 21x21 close and the blur don't see the edge of the window.
+  if the ball isn't in the window we fall back to a full frame search on the same frame, and we
+  do a full search every so often anyway in case a better ball showed up somewhere else.
+ */
+#define TRACK_FULL_SEARCH_INTERVAL 30
+#define TRACK_ROI_SCALE 2.0f
+#define TRACK_ROI_MARGIN 24
+//windows get rounded up to this so the workspace Mats don't get reallocated every time the ball moves
+#define TRACK_ROI_ROUNDING 32
+
+struct ball_tracker
+{
+    KalmanFilter kalman;
+    Mat measurement;
+    bool tracking;
+    Size ball_size;
+    int frames_since_full;
+    long roi_frames;
+    long full_frames;
+    ball_workspace full_ws;
+    ball_workspace roi_ws;
+    vector<Rect> balls;
+};
+
+void init_tracker(ball_tracker *t)
+{
+    //state is (x, y, vx, vy), we measure (x, y)
+    t->kalman.init(4, 2, 0, CV_32F);
+    setIdentity(t->kalman.transitionMatrix);
+    t->kalman.transitionMatrix.at<float>(0, 2) = 1.0f;
+    t->kalman.transitionMatrix.at<float>(1, 3) = 1.0f;
+    setIdentity(t->kalman.measurementMatrix);
+    setIdentity(t->kalman.processNoiseCov, Scalar::all(1e-2));
+    setIdentity(t->kalman.measurementNoiseCov, Scalar::all(1e-1));
+    t->measurement.create(2, 1, CV_32F);
+    t->tracking = false;
+    t->frames_since_full = 0;
+    t->roi_frames = 0;
+    t->full_frames = 0;
+}
+
+Point2f rect_center(const Rect &r)
+{
+    return(Point2f(r.x + r.width * 0.5f, r.y + r.height * 0.5f));
+}
+
+//the ball closest to where we expected it, or the biggest one if we weren't expecting anything
+int pick_ball(const vector<Rect> &balls, bool have_prediction, Point2f predicted)
+{
+    int best = -1;
+    float best_score = 0.0f;
+    for(int i = 0; i < (int)balls.size(); i++)
+    {
+	Point2f d = rect_center(balls[i]) - predicted;
+	float score = have_prediction ? -(d.x * d.x + d.y * d.y) : (float)balls[i].area();
+	if(best < 0 || score > best_score)
+	{
+	    best = i;
+	    best_score = score;
+	}
+    }
+    return(best);
+}
+
+void update_tracker(ball_tracker *t, const Rect &ball)
+{
+    Point2f center = rect_center(ball);
+    t->measurement.at<float>(0) = center.x;
+    t->measurement.at<float>(1) = center.y;
+    if(t->tracking)
+    {
+	t->kalman.correct(t->measurement);
+    }
+    else
+    {
+	t->kalman.statePost.at<float>(0) = center.x;
+	t->kalman.statePost.at<float>(1) = center.y;
+	t->kalman.statePost.at<float>(2) = 0.0f;
+	t->kalman.statePost.at<float>(3) = 0.0f;
+	setIdentity(t->kalman.errorCovPost, Scalar::all(1));
+    }
+    t->tracking = true;
+    t->ball_size = ball.size();
+    t->balls.clear();
+    t->balls.push_back(ball);
+}
+
+Rect search_window(const ball_tracker *t, Point2f predicted, Size frame_size)
+{
+    float vx = fabsf(t->kalman.statePre.at<float>(2));
+    float vy = fabsf(t->kalman.statePre.at<float>(3));
+    int half_w = (int)(t->ball_size.width * TRACK_ROI_SCALE * 0.5f + vx) + TRACK_ROI_MARGIN;
+    int half_h = (int)(t->ball_size.height * TRACK_ROI_SCALE * 0.5f + vy) + TRACK_ROI_MARGIN;
+    half_w = (half_w + TRACK_ROI_ROUNDING - 1) / TRACK_ROI_ROUNDING * TRACK_ROI_ROUNDING;
+    half_h = (half_h + TRACK_ROI_ROUNDING - 1) / TRACK_ROI_ROUNDING * TRACK_ROI_ROUNDING;
+    Rect window((int)predicted.x - half_w, (int)predicted.y - half_h, 2 * half_w, 2 * half_h);
+    return(window & Rect(0, 0, frame_size.width, frame_size.height));
+}
+
+const vector<Rect> &track_ball(ball_tracker *t, Mat frame)
+{
+    bool have_prediction = t->tracking;
+    Point2f predicted;
+    if(have_prediction)
+    {
+	const Mat &state = t->kalman.predict();
+	predicted = Point2f(state.at<float>(0), state.at<float>(1));
+    }
+
+    if(have_prediction && t->frames_since_full < TRACK_FULL_SEARCH_INTERVAL)
+    {
+	Rect window = search_window(t, predicted, frame.size());
+	if(window.area() > 0)
+	{
+	    Mat filtered = overall_filter(frame(window), &t->roi_ws);
+	    vector<Rect> &found = t->roi_ws.balls;
+	    circular_components(filtered, &t->roi_ws);
+	    for(Rect &r : found)
+		r = r + window.tl();
+	    int best = pick_ball(found, true, predicted);
+	    if(best >= 0)
+	    {
+		update_tracker(t, found[best]);
+		t->frames_since_full++;
+		t->roi_frames++;
+		return(t->balls);
+	    }
+	}
+    }
+
+    //lost it, or it's time to look around again
+    t->full_frames++;
+    t->frames_since_full = 0;
+    Mat filtered = overall_filter(frame, &t->full_ws);
+    const vector<Rect> &found = circular_components(filtered, &t->full_ws);
+    int best = pick_ball(found, have_prediction, predicted);
+    if(best >= 0)
+    {
+	update_tracker(t, found[best]);
+    }
+    else
+    {
+	t->tracking = false;
+	t->balls.clear();
+    }
+    return(t->balls);
+}
+
+/*
+  coarse to fine: at 1080p the 21x21 morphology and the hough transform are run over two million
+  pixels to find a couple of balls. instead we pyrDown a few levels, run the filter (with kernels
+  scaled down to match) and the circularity check on the small image to get candidates, and only
+  go back to full resolution inside a window around each candidate, where hough gives us an
+  accurate center and radius. the candidate threshold is looser than CIRCLE_THRESH because a
+  ball that's only a few pixels across at the coarse level doesn't look very round.
+  if hough doesn't find anything in a window we fall back to the circle from the bounding box.
+ */
+#define PYRAMID_CANDIDATE_THRESH 0.6f
+#define PYRAMID_WINDOW_SCALE 1.5f
+#define PYRAMID_WINDOW_MARGIN 24
+
+struct pyramid_workspace
+{
+    vector<Mat> levels;
+    ball_workspace coarse;
+    ball_workspace fine;
+    vector<Vec3f> window_circles;
+    vector<Vec3f> circles;
+};
+
+const vector<Vec3f> &pyramid_detect(Mat frame, int levels, pyramid_workspace *ws)
+{
+    ws->levels.resize(levels + 1);
+    ws->levels[0] = frame;
+    for(int i = 1; i <= levels; i++)
+	pyrDown(ws->levels[i - 1], ws->levels[i]);
+
+    Mat coarse = overall_filter(ws->levels[levels], &ws->coarse, levels);
+    const vector<component_stats> &candidates = component_statistics(coarse, &ws->coarse);
+
+    ws->circles.clear();
+    int scale = 1 << levels;
+    Rect frame_rect(0, 0, frame.cols, frame.rows);
+    for(const component_stats &c : candidates)
+    {
+	if(c.iou < PYRAMID_CANDIDATE_THRESH)
+	    continue;
+	Rect r(c.bounds.x * scale, c.bounds.y * scale, c.bounds.width * scale, c.bounds.height * scale);
+	int size = std::max(r.width, r.height);
+	int pad = (int)(size * (PYRAMID_WINDOW_SCALE - 1.0f) * 0.5f) + PYRAMID_WINDOW_MARGIN;
+	Rect window = Rect(r.x - pad, r.y - pad, r.width + 2 * pad, r.height + 2 * pad) & frame_rect;
+	if(window.area() == 0)
+	    continue;
+
+	Mat fine = overall_filter(frame(window), &ws->fine);
+	int radius = size / 2;
+	hough_circles(fine, ws->window_circles, radius / 2, radius * 3 / 2 + scale);
+	if(!ws->window_circles.empty())
+	{
+	    Vec3f best = ws->window_circles[0];
+	    ws->circles.push_back(Vec3f(best[0] + window.x, best[1] + window.y, best[2]));
+	}
+	else
+	{
+	    Point2f center(r.x + r.width * 0.5f, r.y + r.height * 0.5f);
+	    ws->circles.push_back(Vec3f(center.x, center.y, r.height * 0.5f));
+	}
+    }
+    return(ws->circles);
+}
+
+typedef std::chrono::steady_clock stream_clock;
+
+/*
+  sits in front of opencv's normal Mat allocator and counts every buffer it hands out,
+  so the stream modes can show that once they've warmed up they stop allocating frames.
+  Mats wrapped around memory we already own aren't allocations, so they don't count.
+ */
+struct counting_allocator : public MatAllocator
+{
+    MatAllocator *base;
+    mutable std::atomic<long> allocations;
+    mutable std::atomic<long> bytes;
+
+    UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+		       int flags, UMatUsageFlags usage) const
+    {
+	if(data == nullptr)
+	{
+	    size_t total = CV_ELEM_SIZE(type);
+	    for(int i = 0; i < dims; i++)
+		total *= sizes[i];
+	    allocations++;
+	    bytes += total;
+	}
+	return(base->allocate(dims, sizes, type, data, step, flags, usage));
+    }
+
+    bool allocate(UMatData *data, int access, UMatUsageFlags usage) const
+    {
+	return(base->allocate(data, access, usage));
+    }
+
+    void deallocate(UMatData *data) const
+    {
+	base->deallocate(data);
+    }
+};
+
+counting_allocator mat_allocations;
+
+void count_mat_allocations()
+{
+    mat_allocations.base = Mat::getStdAllocator();
+    mat_allocations.allocations = 0;
+    mat_allocations.bytes = 0;
+    Mat::setDefaultAllocator(&mat_allocations);
+}
+
+bool open_stream(VideoCapture &cap, const char *source, double *pace_fps)
+{
+    bool is_device = is_camera_source(source);
+    if(!open_video_source(cap, source))
+    {
+	fprintf(stderr, "couldn't open %s\n", source);
+	return(false);
+    }
+    //don't let the driver queue up frames behind our back either
+    if(is_device)
+	cap.set(CAP_PROP_BUFFERSIZE, 1);
+    //video files don't pace themselves like a camera does, so we play them back in real time
+    *pace_fps = is_device ? 0.0 : cap.get(CAP_PROP_FPS);
+    return(true);
+}
+
+void pace_capture(stream_clock::time_point *next, double pace_fps)
+{
+    if(pace_fps > 0)
+    {
+	*next += std::chrono::microseconds((long)(1e6 / pace_fps));
+	std::this_thread::sleep_until(*next);
+    }
+}
+
+struct stream_report
+{
+    long processed;
+    long warmup;
+    long warm_allocations;
+    long warm_bytes;
+    double fps;
+    double total_latency;
+    double worst_latency;
+    stream_clock::time_point start;
+    stream_clock::time_point last;
+};
+
+//warmup is how many frames it takes for every buffer in play to have been through the filter once
+void start_report(stream_report *report, long warmup)
+{
+    report->processed = 0;
+    report->warmup = warmup;
+    report->warm_allocations = 0;
+    report->warm_bytes = 0;
+    report->fps = 0.0;
+    report->total_latency = 0.0;
+    report->worst_latency = 0.0;
+    report->start = report->last = stream_clock::now();
+    printf("frame,latency_ms,fps,dropped,balls,x,y,radius\n");
+}
+
+/*
+  writes one csv row per detected ball to stdout (or one row with balls = 0 if there weren't any).
+  latency is measured from when the frame came off the camera to when its detections are written out.
+ */
+void report_frame(stream_report *report, long index, stream_clock::time_point captured, long dropped,
+		  const vector<Rect> &balls)
+{
+    stream_clock::time_point now = stream_clock::now();
+    double latency = std::chrono::duration<double, std::milli>(now - captured).count();
+    double frame_time = std::chrono::duration<double>(now - report->last).count();
+    report->last = now;
+    //smooth the fps a bit so one slow frame doesn't make the number jump around
+#define FPS_SMOOTHING 0.1
+    if(frame_time > 0)
+	report->fps = report->processed == 0 ? 1.0 / frame_time :
+	    (1.0 - FPS_SMOOTHING) * report->fps + FPS_SMOOTHING / frame_time;
+#undef FPS_SMOOTHING
+    report->processed++;
+    if(report->processed == report->warmup)
+    {
+	report->warm_allocations = mat_allocations.allocations.load();
+	report->warm_bytes = mat_allocations.bytes.load();
+    }
+    report->total_latency += latency;
+    report->worst_latency = std::max(report->worst_latency, latency);
+
+    if(balls.empty())
+	printf("%ld,%.2f,%.1f,%ld,0,,,\n", index, latency, report->fps, dropped);
+    for(const Rect &r : balls)
+    {
+	Point center = (r.tl() + r.br()) / 2;
+	printf("%ld,%.2f,%.1f,%ld,%lu,%d,%d,%d\n", index, latency, report->fps, dropped, balls.size(),
+	       center.x, center.y, abs(r.tl().y - center.y));
+    }
+    fflush(stdout);
+}
+
+void finish_report(const stream_report *report, long dropped)
+{
+    double elapsed = std::chrono::duration<double>(stream_clock::now() - report->start).count();
+    fprintf(stderr, "processed %ld frames, dropped %ld, %.1f fps, latency mean %.2f ms worst %.2f ms\n",
+	    report->processed, dropped, elapsed > 0 ? report->processed / elapsed : 0.0,
+	    report->processed > 0 ? report->total_latency / report->processed : 0.0, report->worst_latency);
+    if(report->processed > report->warmup)
+    {
+	long steady = report->processed - report->warmup;
+	long allocations = mat_allocations.allocations.load() - report->warm_allocations;
+	long bytes = mat_allocations.bytes.load() - report->warm_bytes;
+	fprintf(stderr, "%ld Mat allocations (%ld bytes) over the last %ld frames, %.2f per frame\n",
+		allocations, bytes, steady, (double)allocations / steady);
+    }
+}
+
+/*
+  single slot handoff between the capture thread and the detector. the capture thread always
+  overwrites whatever is sitting in the slot, so if the detector falls behind we drop the stale
+  frame instead of building up a queue and falling further and further behind the camera.
+  the Mats get swapped rather than copied so the three buffers just rotate between the threads.
+ */
+struct latest_frame
+{
+    std::mutex lock;
+    std::condition_variable ready;
+    Mat frame;
+    stream_clock::time_point captured;
+    long index;
+    long dropped;
+    bool fresh;
+    bool done;
+};
+
+void capture_frames(VideoCapture *cap, latest_frame *slot, double pace_fps)
+{
+    Mat frame;
+    long index = 0;
+    stream_clock::time_point next = stream_clock::now();
+    while(cap->read(frame))
+    {
+	stream_clock::time_point captured = stream_clock::now();
+	{
+	    std::lock_guard<std::mutex> guard(slot->lock);
+	    if(slot->fresh)
+		slot->dropped++;
+	    std::swap(slot->frame, frame);
+	    slot->captured = captured;
+	    slot->index = index++;
+	    slot->fresh = true;
+	}
+	slot->ready.notify_one();
+	pace_capture(&next, pace_fps);
+    }
+    std::lock_guard<std::mutex> guard(slot->lock);
+    slot->done = true;
+    slot->ready.notify_one();
+}
+
+/*
+  headless mode for the robot: reads from a camera index or a video file and runs the whole filter
+  on one thread. with track set it follows one ball with track_ball instead of searching every frame,
+  with levels > 0 it searches coarse to fine with pyramid_detect.
+ */
+int stream_detections(const char *source, bool track, int levels)
+{
+    VideoCapture cap;
+    double pace_fps;
+    if(!open_stream(cap, source, &pace_fps))
+	return(-1);
+
+    latest_frame slot;
+    slot.index = -1;
+    slot.dropped = 0;
+    slot.fresh = false;
+    slot.done = false;
+    std::thread capture(capture_frames, &cap, &slot, pace_fps);
+
+    //the capture thread, the slot and this thread each hold a frame buffer
+    stream_report report;
+    start_report(&report, 3);
+
+    ball_workspace ws;
+    ball_tracker tracker;
+    init_tracker(&tracker);
+    pyramid_workspace pyramid;
+    vector<Rect> circle_boxes;
+    Mat frame;
+    long dropped = 0;
+    for(;;)
+    {
+	stream_clock::time_point captured;
+	long index;
+	{
+	    std::unique_lock<std::mutex> guard(slot.lock);
+	    slot.ready.wait(guard, [&slot]() { return(slot.fresh || slot.done); });
+	    if(!slot.fresh)
+		break;
+	    std::swap(slot.frame, frame);
+	    slot.fresh = false;
+	    captured = slot.captured;
+	    index = slot.index;
+	    dropped = slot.dropped;
+	}
+
+	if(track)
+	{
+	    report_frame(&report, index, captured, dropped, track_ball(&tracker, frame));
+	    continue;
+	}
+	if(levels > 0)
+	{
+	    circle_boxes.clear();
+	    for(const Vec3f &c : pyramid_detect(frame, levels, &pyramid))
+		circle_boxes.push_back(Rect(cvRound(c[0] - c[2]), cvRound(c[1] - c[2]), cvRound(2 * c[2]), cvRound(2 * c[2])));
+	    report_frame(&report, index, captured, dropped, circle_boxes);
+	    continue;
+	}
+	Mat filtered = overall_filter(frame, &ws);
+	const vector<Rect> &balls = circular_components(filtered, &ws);
+	report_frame(&report, index, captured, dropped, balls);
+    }
+    capture.join();
+    finish_report(&report, dropped);
+    if(track)
+	fprintf(stderr, "tracking: %ld frames searched a window, %ld searched the full frame\n",
+		tracker.roi_frames, tracker.full_frames);
+    return(0);
+}
+
+/*
+  the pipelined version of stream_detections. capture, threshold, morphology and component scoring
+  each get their own thread, and consecutive frames flow through them connected by spsc queues,
+  so on a multicore machine frame n + 1 is being thresholded while frame n is in morphology.
+  depth is the capacity of each queue: deeper queues smooth out jitter between stages and buy
+  throughput, but every queued frame is latency. if the first queue is full the capture thread
+  drops the frame it just read, same as the single threaded mode.
+
+  frames travel as pointers into a fixed pool that the output stage hands back to the capture
+  thread, and each one carries its own workspace, so the Mats inside get reused instead of
+  reallocated and no two stages ever share a buffer. a null pointer means end of stream.
+ */
+struct pipeline_frame
+{
+    long index;
+    stream_clock::time_point captured;
+    Mat image;
+    ball_workspace ws;
+};
+
+typedef spsc_queue<pipeline_frame *> frame_queue;
+
+//spin for a little while since the next frame is usually close, then back off so idle stages don't eat a core
+void queue_backoff(int spins)
+{
+#define SPIN_LIMIT 64
+    if(spins < SPIN_LIMIT)
+	std::this_thread::yield();
+    else
+	std::this_thread::sleep_for(std::chrono::microseconds(100));
+#undef SPIN_LIMIT
+}
+
+void wait_push(frame_queue *q, pipeline_frame *f)
+{
+    for(int spins = 0; !q->try_push(f); spins++)
+	queue_backoff(spins);
+}
+
+pipeline_frame *wait_pop(frame_queue *q)
+{
+    pipeline_frame *f;
+    for(int spins = 0; !q->try_pop(f); spins++)
+	queue_backoff(spins);
+    return(f);
+}
+
+void pipeline_capture(VideoCapture *cap, frame_queue *free_frames, frame_queue *out,
+		      double pace_fps, std::atomic<long> *dropped)
+{
+    long index = 0;
+    stream_clock::time_point next = stream_clock::now();
+    pipeline_frame *f = wait_pop(free_frames);
+    while(cap->read(f->image))
+    {
+	f->index = index++;
+	f->captured = stream_clock::now();
+	if(out->try_push(f))
+	    f = wait_pop(free_frames);
+	else
+	    dropped->fetch_add(1, std::memory_order_relaxed);
+	pace_capture(&next, pace_fps);
+    }
+    wait_push(out, nullptr);
+}
+
+void pipeline_stage(frame_queue *in, frame_queue *out, void (*work)(pipeline_frame *))
+{
+    for(;;)
+    {
+	pipeline_frame *f = wait_pop(in);
+	if(f != nullptr)
+	    work(f);
+	wait_push(out, f);
+	if(f == nullptr)
+	    return;
+    }
+}
+
+void threshold_stage(pipeline_frame *f)
+{
+    threshold_image(f->image, &f->ws);
+}
+
+void morphology_stage(pipeline_frame *f)
+{
+    morphed_img(f->ws.thresh, &f->ws);
+}
+
+void scoring_stage(pipeline_frame *f)
+{
+    circular_components(f->ws.filtered, &f->ws);
+}
+
+int pipelined_detections(const char *source, int depth)
+{
+    VideoCapture cap;
+    double pace_fps;
+    if(!open_stream(cap, source, &pace_fps))
+	return(-1);
+
+    //the stages are our parallelism now, don't let opencv spin up its own threads underneath them
+    setNumThreads(1);
+
+    //four queues of depth frames each plus one frame in the hands of each of the five threads
+    //means the capture thread can never find the free list empty
+    size_t pool_size = 4 * depth + 5;
+    vector<pipeline_frame> pool(pool_size);
+    frame_queue free_frames(pool_size);
+    for(pipeline_frame &f : pool)
+	free_frames.try_push(&f);
+
+    frame_queue thresh_in(depth), morph_in(depth), score_in(depth), done(depth);
+    std::atomic<long> dropped(0);
+    std::thread capture(pipeline_capture, &cap, &free_frames, &thresh_in, pace_fps, &dropped);
+    std::thread thresh(pipeline_stage, &thresh_in, &morph_in, threshold_stage);
+    std::thread morph(pipeline_stage, &morph_in, &score_in, morphology_stage);
+    std::thread score(pipeline_stage, &score_in, &done, scoring_stage);
+
+    stream_report report;
+    start_report(&report, pool_size);
+    for(;;)
+    {
+	pipeline_frame *f = wait_pop(&done);
+	if(f == nullptr)
+	    break;
+	report_frame(&report, f->index, f->captured, dropped.load(std::memory_order_relaxed), f->ws.balls);
+	wait_push(&free_frames, f);
+    }
+
+    capture.join();
+    thresh.join();
+    morph.join();
+    score.join();
+    finish_report(&report, dropped.load());
+    return(0);
+}
+
+struct circle_accuracy
+{
+    int matched;
+    int missed;
+    int extra;
+    double center_error;
+    double radius_error;
+};
+
+//matches each reference circle to the nearest found circle whose center is within half the reference radius
+void compare_circles(const vector<Vec3f> &reference, const vector<Vec3f> &found, circle_accuracy *acc)
+{
+    vector<bool> used(found.size(), false);
+    for(const Vec3f &ref : reference)
+    {
+	int best = -1;
+	double best_dist = 0.0;
+	for(int i = 0; i < (int)found.size(); i++)
+	{
+	    double dx = found[i][0] - ref[0];
+	    double dy = found[i][1] - ref[1];
+	    double dist = sqrt(dx * dx + dy * dy);
+	    if(!used[i] && dist <= ref[2] * 0.5 && (best < 0 || dist < best_dist))
+	    {
+		best = i;
+		best_dist = dist;
+	    }
+	}
+	if(best < 0)
+	{
+	    acc->missed++;
+	    continue;
+	}
+	used[best] = true;
+	acc->matched++;
+	acc->center_error += best_dist;
+	acc->radius_error += fabs(found[best][2] - ref[2]);
+    }
+    for(bool u : used)
+	acc->extra += !u;
+}
+
+/*
+  times the full resolution filter + hough path against pyramid_detect at 1 to max_levels levels
+  on an image (run over and over) or every frame of a video, and scores the pyramid's circles
+  against the full resolution ones.
+ */
+int pyramid_bench(const char *source, int max_levels)
+{
+#define BENCH_IMAGE_ITERATIONS 20
+    vector<Mat> frames;
+    Mat image = imread(source, 1);
+    if(image.data)
+    {
+	for(int i = 0; i < BENCH_IMAGE_ITERATIONS; i++)
+	    frames.push_back(image);
+    }
+    else
+    {
+	VideoCapture cap(source);
+	Mat frame;
+	while(cap.read(frame))
+	    frames.push_back(frame.clone());
+    }
+#undef BENCH_IMAGE_ITERATIONS
+    if(frames.empty())
+    {
+	fprintf(stderr, "couldn't read %s\n", source);
+	return(-1);
+    }
+
+    ball_workspace ws;
+    vector<vector<Vec3f> > reference(frames.size());
+    stream_clock::time_point start = stream_clock::now();
+    for(int i = 0; i < (int)frames.size(); i++)
+	hough_circles(overall_filter(frames[i], &ws), reference[i]);
+    double full_ms = std::chrono::duration<double, std::milli>(stream_clock::now() - start).count() / frames.size();
+
+    printf("%dx%d, %lu frames\n", frames[0].cols, frames[0].rows, frames.size());
+    printf("%-6s %10s %8s %8s %6s %6s %12s %12s\n", "levels", "ms/frame", "speedup", "matched", "missed", "extra",
+	   "center err", "radius err");
+    printf("%-6s %10.3f %7.2fx\n", "full", full_ms, 1.0);
+    for(int levels = 1; levels <= max_levels; levels++)
+    {
+	pyramid_workspace pyramid;
+	circle_accuracy acc = { 0, 0, 0, 0.0, 0.0 };
+	double total_ms = 0.0;
+	for(int i = 0; i < (int)frames.size(); i++)
+	{
+	    stream_clock::time_point frame_start = stream_clock::now();
+	    const vector<Vec3f> &found = pyramid_detect(frames[i], levels, &pyramid);
+	    total_ms += std::chrono::duration<double, std::milli>(stream_clock::now() - frame_start).count();
+	    compare_circles(reference[i], found, &acc);
+	}
+	double ms = total_ms / frames.size();
+	printf("%-6d %10.3f %7.2fx %8d %6d %6d %10.2fpx %10.2fpx\n", levels, ms, full_ms / ms,
+	       acc.matched, acc.missed, acc.extra,
+	       acc.matched ? acc.center_error / acc.matched : 0.0, acc.matched ? acc.radius_error / acc.matched : 0.0);
+    }
+    return(0);
+}
+
+//define CV_PRACTICE_NO_MAIN to include the detector in another program (see common/tracker_bench.cpp)
+#ifndef CV_PRACTICE_NO_MAIN
 int main(int argc, char** argv)
 {
+    if(argc < 2)
+    {
+	fprintf(stderr, "usage: %s <image> | --stream <camera index | video file> [--depth n | --track | --levels n]\n"
+		"       %s --pyramid-bench <image | video file> [max levels]\n", argv[0], argv[0]);
+	return -1;
+    }
+    if(strcmp(argv[1], "--pyramid-bench") == 0 && argc >= 3)
+	return(pyramid_bench(argv[2], argc >= 4 ? atoi(argv[3]) : 3));
+    if(strcmp(argv[1], "--stream") == 0)
+    {
+	if(argc < 3)
+	{
+	    fprintf(stderr, "usage: %s --stream <camera index | video file> [--depth n | --track | --levels n]\n", argv[0]);
+	    return -1;
+	}
+	count_mat_allocations();
+	//--depth n runs the stages on their own threads with n frames of queue between each
+	//--track follows one ball through a window instead of searching the whole frame
+	//--levels n searches n pyramid levels down and refines candidates at full resolution
+	int depth = 0;
+	int levels = 0;
+	bool track = false;
+	for(int i = 3; i < argc; i++)
+	{
+	    if(strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+		depth = atoi(argv[++i]);
+	    else if(strcmp(argv[i], "--track") == 0)
+		track = true;
+	    else if(strcmp(argv[i], "--levels") == 0 && i + 1 < argc)
+		levels = atoi(argv[++i]);
+	}
+	if(depth > 0 && !track && levels == 0)
+	    return(pipelined_detections(argv[2], depth));
+	return(stream_detections(argv[2], track, levels));
+    }
+
     Mat src;
 
     /// Read the image
@@ -157,3 +1000,4 @@ int main(int argc, char** argv)
     waitKey(0);
     return 0;
 }
+#endif
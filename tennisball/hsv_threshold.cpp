@@ -0,0 +1,250 @@
+#include <stdint.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HSV_THRESHOLD_X86
+#endif
+
+using namespace cv;
+
+/*
+  the yellow range threshold_image used to get from cvtColor(CV_BGR2HSV) + inRange, i.e.
+  Scalar(0.11 * 256, 0.60 * 256, 0.20 * 256) to Scalar(0.14 * 256, 1.0 * 255.0, 1.0 * 256)
+  after inRange rounds and saturates them to 8 bits.
+ */
+#define YELLOW_H_MIN 28
+#define YELLOW_H_MAX 36
+#define YELLOW_S_MIN 154
+#define YELLOW_V_MIN 51
+
+/*
+  instead of converting to hsv and then testing, we test the bgr pixel directly. with
+  v = max(b, g, r) and diff = v - min(b, g, r), opencv's 8 bit conversion is
+      s = round(255 * diff / v)
+      h = round(30 * (g - b) / diff)        when v == r
+      h = 60 + round(30 * (b - r) / diff)   when v == g
+  so every bound turns into an integer comparison with no division. the hue bounds only
+  handle the band between red and green, which is where yellow lives.
+ */
+static_assert(0 < YELLOW_H_MIN && YELLOW_H_MIN <= YELLOW_H_MAX && YELLOW_H_MAX < 60,
+	      "the fused threshold only handles hues between red and green");
+
+inline bool in_yellow_range(int b, int g, int r)
+{
+    int v = std::max(std::max(b, g), r);
+    int diff = v - std::min(std::min(b, g), r);
+    if(v < YELLOW_V_MIN || 510 * diff < (2 * YELLOW_S_MIN - 1) * v)
+	return(false);
+    if(v == r)
+	return(60 * (g - b) >= (2 * YELLOW_H_MIN - 1) * diff && 60 * (g - b) < (2 * YELLOW_H_MAX + 1) * diff);
+    if(v == g)
+	return(60 * (r - b) <= (121 - 2 * YELLOW_H_MIN) * diff && 60 * (r - b) > (119 - 2 * YELLOW_H_MAX) * diff);
+    return(false);
+}
+
+void yellow_mask_row_scalar(const uchar *bgr, uchar *mask, int n)
+{
+    for(int i = 0; i < n; i++, bgr += 3)
+	mask[i] = in_yellow_range(bgr[0], bgr[1], bgr[2]) ? 255 : 0;
+}
+
+#ifdef HSV_THRESHOLD_X86
+//pulls 16 interleaved bgr pixels apart into one register per channel
+__attribute__((target("sse4.1")))
+static inline void deinterleave_bgr(const uchar *p, __m128i &b, __m128i &g, __m128i &r)
+{
+    __m128i a0 = _mm_loadu_si128((const __m128i *)p);
+    __m128i a1 = _mm_loadu_si128((const __m128i *)(p + 16));
+    __m128i a2 = _mm_loadu_si128((const __m128i *)(p + 32));
+
+    b = _mm_or_si128(_mm_or_si128(
+	    _mm_shuffle_epi8(a0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+	    _mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+	    _mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+    g = _mm_or_si128(_mm_or_si128(
+	    _mm_shuffle_epi8(a0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+	    _mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+	    _mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+    r = _mm_or_si128(_mm_or_si128(
+	    _mm_shuffle_epi8(a0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+	    _mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+	    _mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+}
+
+/*
+  in_yellow_range on 8 pixels widened to 16 bit lanes. everything fits in 16 bits except the
+  saturation test, which is rewritten as 255 * diff >= (S_MIN - 1) * v + ceil(v / 2) and done
+  unsigned since 255 * 255 doesn't fit in a signed lane.
+ */
+__attribute__((target("sse4.1")))
+static inline __m128i yellow_lanes_sse(__m128i b, __m128i g, __m128i r)
+{
+    __m128i v = _mm_max_epi16(_mm_max_epi16(b, g), r);
+    __m128i diff = _mm_sub_epi16(v, _mm_min_epi16(_mm_min_epi16(b, g), r));
+
+    __m128i v_ok = _mm_cmpgt_epi16(v, _mm_set1_epi16(YELLOW_V_MIN - 1));
+    __m128i s_lhs = _mm_mullo_epi16(diff, _mm_set1_epi16(255));
+    __m128i s_rhs = _mm_add_epi16(_mm_mullo_epi16(v, _mm_set1_epi16(YELLOW_S_MIN - 1)),
+				  _mm_srli_epi16(_mm_add_epi16(v, _mm_set1_epi16(1)), 1));
+    __m128i s_ok = _mm_cmpeq_epi16(_mm_max_epu16(s_lhs, s_rhs), s_lhs);
+
+    __m128i gb = _mm_mullo_epi16(_mm_sub_epi16(g, b), _mm_set1_epi16(60));
+    __m128i rb = _mm_mullo_epi16(_mm_sub_epi16(r, b), _mm_set1_epi16(60));
+    __m128i r_hue = _mm_andnot_si128(
+	_mm_cmpgt_epi16(_mm_mullo_epi16(diff, _mm_set1_epi16(2 * YELLOW_H_MIN - 1)), gb),
+	_mm_cmpgt_epi16(_mm_mullo_epi16(diff, _mm_set1_epi16(2 * YELLOW_H_MAX + 1)), gb));
+    __m128i g_hue = _mm_andnot_si128(
+	_mm_cmpgt_epi16(rb, _mm_mullo_epi16(diff, _mm_set1_epi16(121 - 2 * YELLOW_H_MIN))),
+	_mm_cmpgt_epi16(rb, _mm_mullo_epi16(diff, _mm_set1_epi16(119 - 2 * YELLOW_H_MAX))));
+    __m128i r_max = _mm_cmpeq_epi16(v, r);
+    __m128i g_max = _mm_andnot_si128(r_max, _mm_cmpeq_epi16(v, g));
+    __m128i hue_ok = _mm_or_si128(_mm_and_si128(r_max, r_hue), _mm_and_si128(g_max, g_hue));
+
+    return(_mm_and_si128(_mm_and_si128(v_ok, s_ok), hue_ok));
+}
+
+__attribute__((target("sse4.1")))
+void yellow_mask_row_sse41(const uchar *bgr, uchar *mask, int n)
+{
+    int i = 0;
+    for(; i + 16 <= n; i += 16, bgr += 48)
+    {
+	__m128i b, g, r;
+	deinterleave_bgr(bgr, b, g, r);
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = yellow_lanes_sse(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(g, zero), _mm_unpacklo_epi8(r, zero));
+	__m128i hi = yellow_lanes_sse(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(r, zero));
+	_mm_storeu_si128((__m128i *)(mask + i), _mm_packs_epi16(lo, hi));
+    }
+    yellow_mask_row_scalar(bgr, mask + i, n - i);
+}
+
+//same as the sse version, but 16 pixels per 16 bit register
+__attribute__((target("avx2")))
+static inline __m256i yellow_lanes_avx2(__m256i b, __m256i g, __m256i r)
+{
+    __m256i v = _mm256_max_epi16(_mm256_max_epi16(b, g), r);
+    __m256i diff = _mm256_sub_epi16(v, _mm256_min_epi16(_mm256_min_epi16(b, g), r));
+
+    __m256i v_ok = _mm256_cmpgt_epi16(v, _mm256_set1_epi16(YELLOW_V_MIN - 1));
+    __m256i s_lhs = _mm256_mullo_epi16(diff, _mm256_set1_epi16(255));
+    __m256i s_rhs = _mm256_add_epi16(_mm256_mullo_epi16(v, _mm256_set1_epi16(YELLOW_S_MIN - 1)),
+				     _mm256_srli_epi16(_mm256_add_epi16(v, _mm256_set1_epi16(1)), 1));
+    __m256i s_ok = _mm256_cmpeq_epi16(_mm256_max_epu16(s_lhs, s_rhs), s_lhs);
+
+    __m256i gb = _mm256_mullo_epi16(_mm256_sub_epi16(g, b), _mm256_set1_epi16(60));
+    __m256i rb = _mm256_mullo_epi16(_mm256_sub_epi16(r, b), _mm256_set1_epi16(60));
+    __m256i r_hue = _mm256_andnot_si256(
+	_mm256_cmpgt_epi16(_mm256_mullo_epi16(diff, _mm256_set1_epi16(2 * YELLOW_H_MIN - 1)), gb),
+	_mm256_cmpgt_epi16(_mm256_mullo_epi16(diff, _mm256_set1_epi16(2 * YELLOW_H_MAX + 1)), gb));
+    __m256i g_hue = _mm256_andnot_si256(
+	_mm256_cmpgt_epi16(rb, _mm256_mullo_epi16(diff, _mm256_set1_epi16(121 - 2 * YELLOW_H_MIN))),
+	_mm256_cmpgt_epi16(rb, _mm256_mullo_epi16(diff, _mm256_set1_epi16(119 - 2 * YELLOW_H_MAX))));
+    __m256i r_max = _mm256_cmpeq_epi16(v, r);
+    __m256i g_max = _mm256_andnot_si256(r_max, _mm256_cmpeq_epi16(v, g));
+    __m256i hue_ok = _mm256_or_si256(_mm256_and_si256(r_max, r_hue), _mm256_and_si256(g_max, g_hue));
+
+    return(_mm256_and_si256(_mm256_and_si256(v_ok, s_ok), hue_ok));
+}
+
+__attribute__((target("avx2")))
+void yellow_mask_row_avx2(const uchar *bgr, uchar *mask, int n)
+{
+    int i = 0;
+    for(; i + 32 <= n; i += 32, bgr += 96)
+    {
+	__m128i b0, g0, r0, b1, g1, r1;
+	deinterleave_bgr(bgr, b0, g0, r0);
+	deinterleave_bgr(bgr + 48, b1, g1, r1);
+	__m256i lo = yellow_lanes_avx2(_mm256_cvtepu8_epi16(b0), _mm256_cvtepu8_epi16(g0), _mm256_cvtepu8_epi16(r0));
+	__m256i hi = yellow_lanes_avx2(_mm256_cvtepu8_epi16(b1), _mm256_cvtepu8_epi16(g1), _mm256_cvtepu8_epi16(r1));
+	//packs works within 128 bit lanes, so put the quadwords back in order afterwards
+	__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xD8);
+	_mm256_storeu_si256((__m256i *)(mask + i), packed);
+    }
+    yellow_mask_row_sse41(bgr, mask + i, n - i);
+}
+#endif
+
+typedef void (*yellow_row_kernel)(const uchar *, uchar *, int);
+
+yellow_row_kernel best_yellow_kernel()
+{
+#ifdef HSV_THRESHOLD_X86
+    if(__builtin_cpu_supports("avx2"))
+	return(yellow_mask_row_avx2);
+    if(__builtin_cpu_supports("sse4.1"))
+	return(yellow_mask_row_sse41);
+#endif
+    return(yellow_mask_row_scalar);
+}
+
+void yellow_mask(const Mat &bgr, Mat &mask, yellow_row_kernel kernel)
+{
+    CV_Assert(bgr.type() == CV_8UC3);
+    mask.create(bgr.rows, bgr.cols, CV_8UC1);
+    for(int y = 0; y < bgr.rows; y++)
+	kernel(bgr.ptr<uchar>(y), mask.ptr<uchar>(y), bgr.cols);
+}
+
+//bgr straight to the 8 bit mask in one pass, never materializing the hsv image
+void yellow_mask(const Mat &bgr, Mat &mask)
+{
+    static yellow_row_kernel kernel = best_yellow_kernel();
+    yellow_mask(bgr, mask, kernel);
+}
+
+/*
+  the lookup table version: bgr quantized to YELLOW_LUT_BITS per channel, one bit per cell.
+  at 6 bits that's 32KB, so it sits in L1. each cell takes the answer at its center,
+  so pixels right on the edge of the range can come out differently than the exact test.
+ */
+#define YELLOW_LUT_BITS 6
+#define YELLOW_LUT_SHIFT (8 - YELLOW_LUT_BITS)
+
+const std::vector<uint8_t> &yellow_lut()
+{
+    static std::vector<uint8_t> lut;
+    if(lut.empty())
+    {
+	const int cells = 1 << YELLOW_LUT_BITS;
+	const int half = (1 << YELLOW_LUT_SHIFT) / 2;
+	lut.assign((cells * cells * cells + 7) / 8, 0);
+	for(int b = 0; b < cells; b++)
+	    for(int g = 0; g < cells; g++)
+		for(int r = 0; r < cells; r++)
+		{
+		    int idx = (((b << YELLOW_LUT_BITS) | g) << YELLOW_LUT_BITS) | r;
+		    if(in_yellow_range((b << YELLOW_LUT_SHIFT) + half, (g << YELLOW_LUT_SHIFT) + half,
+				       (r << YELLOW_LUT_SHIFT) + half))
+			lut[idx >> 3] |= 1 << (idx & 7);
+		}
+    }
+    return(lut);
+}
+
+void yellow_mask_lut(const Mat &bgr, Mat &mask)
+{
+    CV_Assert(bgr.type() == CV_8UC3);
+    const uint8_t *lut = yellow_lut().data();
+    mask.create(bgr.rows, bgr.cols, CV_8UC1);
+    for(int y = 0; y < bgr.rows; y++)
+    {
+	const uchar *p = bgr.ptr<uchar>(y);
+	uchar *m = mask.ptr<uchar>(y);
+	for(int x = 0; x < bgr.cols; x++, p += 3)
+	{
+	    int idx = ((((p[0] >> YELLOW_LUT_SHIFT) << YELLOW_LUT_BITS) | (p[1] >> YELLOW_LUT_SHIFT)) << YELLOW_LUT_BITS)
+		| (p[2] >> YELLOW_LUT_SHIFT);
+	    m[x] = (lut[idx >> 3] >> (idx & 7)) & 1 ? 255 : 0;
+	}
+    }
+}
+
+//the original two pass version, kept around to check the others against
+void yellow_mask_hsv(const Mat &bgr, Mat &mask)
+{
+    Mat hsv;
+    cvtColor(bgr, hsv, CV_BGR2HSV);
+    inRange(hsv, Scalar(0.11 * 256, 0.60 * 256, 0.20 * 256), Scalar(0.14 * 256, 1.0 * 255.0, 1.0 * 256), mask);
+}
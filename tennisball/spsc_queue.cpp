@@ -0,0 +1,43 @@
+#include <atomic>
+#include <vector>
+#include <stddef.h>
+
+/*
+  bounded lock-free ring buffer for exactly one producer thread and one consumer thread.
+  head is only written by the consumer and tail only by the producer, so all we need is
+  acquire/release on the indices. they live on separate cache lines so the two threads
+  aren't fighting over the same line every push and pop.
+ */
+template<typename T>
+struct spsc_queue
+{
+    std::vector<T> slots;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+
+    //one slot is always left empty so full and empty can be told apart
+    explicit spsc_queue(size_t capacity) : slots(capacity + 1), head(0), tail(0)
+    {
+    }
+
+    bool try_push(const T &item)
+    {
+	size_t t = tail.load(std::memory_order_relaxed);
+	size_t next = t + 1 == slots.size() ? 0 : t + 1;
+	if(next == head.load(std::memory_order_acquire))
+	    return(false);
+	slots[t] = item;
+	tail.store(next, std::memory_order_release);
+	return(true);
+    }
+
+    bool try_pop(T &item)
+    {
+	size_t h = head.load(std::memory_order_relaxed);
+	if(h == tail.load(std::memory_order_acquire))
+	    return(false);
+	item = slots[h];
+	head.store(h + 1 == slots.size() ? 0 : h + 1, std::memory_order_release);
+	return(true);
+    }
+};
@@ -0,0 +1,90 @@
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include "hsv_threshold.cpp"
+
+//./threshold_bench
+//./threshold_bench /mnt/c/Users/Sasha/Downloads/tennisball2.jpg
+
+#define ITERATIONS 50
+
+//noise with a handful of yellow balls on it, for when we don't have a real frame handy
+Mat synthetic_frame(Size size)
+{
+    Mat frame(size, CV_8UC3);
+    randu(frame, Scalar::all(0), Scalar::all(255));
+    RNG rng(1234);
+    for(int i = 0; i < 20; i++)
+    {
+	Point center(rng.uniform(0, size.width), rng.uniform(0, size.height));
+	circle(frame, center, rng.uniform(10, size.height / 8), Scalar(40, 220, 230), -1);
+    }
+    return(frame);
+}
+
+double mismatch_percent(const Mat &a, const Mat &b)
+{
+    Mat diff;
+    bitwise_xor(a, b, diff);
+    return(100.0 * countNonZero(diff) / (double)a.total());
+}
+
+void run(const char *name, void (*threshold)(const Mat &, Mat &), const Mat &frame, const Mat &reference, double baseline_ms)
+{
+    Mat mask;
+    threshold(frame, mask);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < ITERATIONS; i++)
+	threshold(frame, mask);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / ITERATIONS;
+    double mismatch = reference.empty() ? 0.0 : mismatch_percent(mask, reference);
+    printf("  %-10s %8.3f ms %8.1f Mpix/s %6.2fx  %.4f%% mismatched\n", name, ms,
+	   frame.total() / ms / 1000.0, baseline_ms > 0 ? baseline_ms / ms : 1.0, mismatch);
+}
+
+//the kernels go through a function pointer so the bench can force each one regardless of what the cpu picks
+void scalar_mask(const Mat &bgr, Mat &mask) { yellow_mask(bgr, mask, yellow_mask_row_scalar); }
+#ifdef HSV_THRESHOLD_X86
+void sse41_mask(const Mat &bgr, Mat &mask) { yellow_mask(bgr, mask, yellow_mask_row_sse41); }
+void avx2_mask(const Mat &bgr, Mat &mask) { yellow_mask(bgr, mask, yellow_mask_row_avx2); }
+#endif
+
+int main(int argc, char** argv)
+{
+    Mat src;
+    if(argc > 1)
+	src = imread(argv[1], 1);
+
+    Size sizes[] = { Size(1280, 720), Size(1920, 1080) };
+    for(Size size : sizes)
+    {
+	Mat frame;
+	if(src.data)
+	    resize(src, frame, size);
+	else
+	    frame = synthetic_frame(size);
+
+	Mat reference;
+	yellow_mask_hsv(frame, reference);
+
+	Mat mask;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(int i = 0; i < ITERATIONS; i++)
+	    yellow_mask_hsv(frame, mask);
+	double baseline_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / ITERATIONS;
+
+	printf("%dx%d\n", size.width, size.height);
+	run("hsv", yellow_mask_hsv, frame, reference, baseline_ms);
+	run("scalar", scalar_mask, frame, reference, baseline_ms);
+#ifdef HSV_THRESHOLD_X86
+	if(__builtin_cpu_supports("sse4.1"))
+	    run("sse4.1", sse41_mask, frame, reference, baseline_ms);
+	if(__builtin_cpu_supports("avx2"))
+	    run("avx2", avx2_mask, frame, reference, baseline_ms);
+#endif
+	run("lut", yellow_mask_lut, frame, reference, baseline_ms);
+    }
+    return(0);
+}